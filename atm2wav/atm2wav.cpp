@@ -36,406 +36,625 @@ http://www.stairwaytohell.com/atom/wouterras/romdisas.zip
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <iomanip>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 #include "shared/argcrack.h"
+#include "shared/mapfile.h"
 #include "shared/defines.h"
 #include "shared/atmheader.h"
+#include "shared/freqout.h"
+#include "shared/cuts.h"
+#include "shared/json.h"
 
-#include <math.h>
-#ifndef PI
-#define PI 3.14159265358979323846
-#endif
+#define VSNSTR "1.10.0"
 
-#define VSNSTR "1.2.0"
 
-class freqout
+// Reads an .atm into ram, trying the name with .atm on the end if it
+// isn't there as given.
+//
+bool readatm(std::string& name, std::vector<BYTE>& data)
 {
-public:
-	/* From some old text or other (ATAP probably):
-
-		A logic 0 consists of 4 cycles of a 1.2 kHz tone,
-		and a logic 1 consists of 8 cycles of a 2.4 kHz tone.
-
-		Each byte of data is preceeded by a logic zero start bit,
-		and is terminated by a logic 1 stop bit.
-	*/
+	std::ifstream in(name.c_str(), std::ios_base::in | std::ios_base::binary);
+	if (!in.is_open())
+	{
+		name += ".atm";
+		in.open(name.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (!in.is_open())
+		{
+			return false;
+		}
+	}
 
-	// 1 cycle of 1200hz = 36.75 samples @ 44100hz
-	// 36.75 * 4 = 147 samples
-	//
-	// 1 cycle of 2400hz = 18.375 samples @ 44100hz
-	// 18.375 * 8 = 147 samples
+	in.seekg(0, std::ios_base::end);
+	data.resize((unsigned int)(in.tellg()));
+	in.seekg(0, std::ios_base::beg);
 
-	// Bit position (0..7) to mask
-	//
-	inline BYTE _BV(int x) const
+	atmheader atm;
+	if (data.size() < atm.size())
 	{
-		return (BYTE)(1 << x);
+		return false;
 	}
 
-	freqout(BYTE* rawdata, std::ofstream& out) :
-		_rawData(rawdata),
-		_out(out),
-		_writtenSampleCount(0)
-	{
-		// Build the output table. 4 cycles into 147 bytes.
-		//
-		double val = 0;
-		double step = (PI * 8.0) / 147.0;
+	in.read((char*)&data.front(), (std::streamsize)data.size());
+	return true;
+}
+
+
+// One program on a compilation tape, and where in the file it goes.
+//
+struct compilationpart
+{
+	BYTE* rawdata;
+	long long offset;
+	int gap;
+	bool ok;
+};
+
+
+// Renders the programs of a compilation a core each until they're done.
+// Each one has its own stream on the file, seeked to its offset, and
+// there's nothing to share but the next job number.
+//
+bool renderCompilation(const std::string& outName, std::vector<compilationpart>& parts, int bitsPerSample, int sampleRate, const tapetiming& timing, bool unnamed)
+{
+	std::atomic<size_t> next(0);
 
-		for (int i = 0; i < 147; ++i)
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < parts.size(); i = next++)
 		{
-			double s = sin(val) * 16384.0;
+			compilationpart& part = parts[i];
 
-			// Sinusoidal data doesn't look to good at this audio resolution,
-			// so square it off.
-			//
-			if (s >= 0.0)
-			{
-				s = -16384;
-			}
-			else
+			std::ofstream out(outName.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			out.seekp(part.offset);
+
+			std::unique_ptr<freqout> fo(newFreqout(part.rawdata, out, bitsPerSample, sampleRate));
+			part.ok = out.good() && (unnamed ? fo->writeunnamed(timing) : fo->write(timing));
+			if (part.gap)
 			{
-				s = 16384;
+				fo->outGap(part.gap);
 			}
-
-			_sine[i] = short(s);
-			val += step;
+			fo->flush();
+			out.flush();
+			part.ok = part.ok && out.good();
 		}
+	};
 
-		_is8bit = false;
-		BITSPERSAMPLE = 16;
+	unsigned int cores = std::thread::hardware_concurrency();
+	size_t threadCount = cores ? cores : 1;
+	if (threadCount > parts.size())
+	{
+		threadCount = parts.size();
 	}
 
-	// Output a 1 bit, 8 cycles of 24khz
-	//
-	virtual void out1(void)
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < threadCount; ++i)
 	{
-		for (int i = 0; i < 147; ++i)
-		{
-			// Double step the table for a higher frequency
-			//
-			short val = _sine[(i * 2) % 147];
-			BYTE lo = (val >> 8) & 255;
-			BYTE hi = val & 255;
-			_out.put(hi);
-			_out.put(lo);
-		}
-		_writtenSampleCount += 147;
+		threads.push_back(std::thread(worker));
+	}
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i].join();
 	}
 
-	// Output a 0 bit, 4 cycles of 12khz
-	//
-	virtual void out0(void)
+	for (size_t i = 0; i < parts.size(); ++i)
 	{
-		for (int i = 0; i < 147; ++i)
+		if (!parts[i].ok)
 		{
-			short val = _sine[i];
-			BYTE lo = (val >> 8) & 255;
-			BYTE hi = val & 255;
-			_out.put(hi);
-			_out.put(lo);
+			return false;
 		}
-		_writtenSampleCount += 147;
 	}
+	return true;
+}
 
-	// Output a byte plus its surrounding start & stop bit.
-	// Add the byte's value to the rolling checksum.
-	//
-	void outByte(BYTE value)
+
+
+
+// A piece of tape that can be rendered on its own: a named block, all of
+// an unnamed program, or the silence after a program. Where it starts is
+// worked out beforehand.
+//
+struct renderjob
+{
+	BYTE* rawdata;
+	freqout::blockplan block;
+	int gap;
+	long long sample;
+	int phase;
+};
+
+
+// Every piece of the tape in order, and where each goes.
+//
+void planJobs(std::vector<std::vector<BYTE> >& programs, const std::vector<long long>& starts, int gap, freqout& planner, const tapetiming& timing, bool unnamed, std::vector<renderjob>& jobs)
+{
+	jobs.clear();
+	planner._loader = NULL;
+	for (size_t i = 0; i < programs.size(); ++i)
 	{
-		out0();
-		for (int i = 0; i < 8; ++i)
+		renderjob job;
+		job.rawdata = &programs[i].front();
+		job.gap = 0;
+		job.sample = starts[i];
+		job.phase = 0;
+
+		planner._rawData = job.rawdata;
+		if (unnamed)
 		{
-			if (value & _BV(i))
-			{
-				out1();
-			}
-			else
+			jobs.push_back(job);
+		}
+		else
+		{
+			std::vector<freqout::blockplan> blocks;
+			planner.planBlocks(timing, blocks);
+			for (size_t b = 0; b < blocks.size(); ++b)
 			{
-				out0();
+				job.block = blocks[b];
+				job.sample = starts[i] + planner.bitStart(blocks[b].firstBit, job.phase);
+				jobs.push_back(job);
 			}
 		}
-		out1();
 
-		_checksum += value;
+		if (gap && i + 1 < programs.size())
+		{
+			job.rawdata = NULL;
+			job.gap = gap;
+			job.sample = starts[i + 1] - planner.gapSamples(gap);
+			job.phase = 0;
+			jobs.push_back(job);
+		}
 	}
+}
 
+// Renders one job wherever 'fo' is pointed.
+//
+void renderJob(freqout& fo, const renderjob& job, const tapetiming& timing, bool unnamed)
+{
+	fo._phase = job.phase;
 
-	// Write atom formatted data to the wave file.
-	//
-	bool write(bool shortheaders)
+	if (job.gap)
+	{
+		fo.outGap(job.gap);
+	}
+	else if (unnamed)
+	{
+		fo._rawData = job.rawdata;
+		fo.writeunnamed(timing);
+	}
+	else
 	{
-		atmheader atm;
-		atm.read(_rawData);
+		fo.writeBlock(job.block);
+	}
+}
 
-		BYTE* dataEnd = _rawData + atm.header.length;
 
-		int blockNum = 0;
-		int blockLoadAddr = atm.header.start;
+// Lays out the whole tape, maps a file that size and renders all the
+// blocks of all the programs into it at once, straight into the mapping.
+//
+bool renderMapped(const std::string& outName, std::vector<std::vector<BYTE> >& programs, const std::vector<long long>& starts, int gap, int bitsPerSample, int sampleRate, const tapetiming& timing, bool unnamed, const std::vector<freqout::cuepoint>& cues, bool wave64)
+{
+	int bytesPerSample = bitsPerSample / 8;
 
-		// Bit 7 = last block. Clear = last block.
-		// Bit 6 = do load me. Set = load. Clear = don't.
-		// Bit 5 = first block. Clear = first block.
-		//
-		BYTE flags = _BV(7) | _BV(6);
+	// The freqouts never touch their stream, everything goes to _direct.
+	//
+	std::ostream unused(NULL);
 
-		// Initial header time about 4 1/2 seconds. One out() call puts ~3.3ms of data.
-		//
-		float headerTime = float(shortheaders ? 2500 : 4550);
+	std::unique_ptr<freqout> planner(newFreqout(NULL, unused, bitsPerSample, sampleRate));
+	planner->_cues = cues;
+	planner->_wave64 = wave64;
+	int headerBytes = planner->waveHeaderBytes(starts.back());
 
-		while (flags & _BV(7))
-		{
-			while(headerTime > 0.0)
-			{
-				out1();
-				headerTime -= 3.3F;
-			}
+	// A 32 bit build can't map more than 4GB, whatever the file can hold.
+	//
+	long long fileBytes = planner->waveFileBytes(starts.back());
+	if ((long long)(size_t)fileBytes != fileBytes)
+	{
+		return false;
+	}
 
-			_checksum = 0;
+	mapfile map;
+	char* data = map.create(outName.c_str(), size_t(fileBytes));
+	if (!data)
+	{
+		return false;
+	}
 
-			// Preamble
-			//
-			outByte('*');
-			outByte('*');
-			outByte('*');
-			outByte('*');
+	planner->_direct = data;
+	planner->createWaveFile(starts.back());
 
-			// Header max 14 chars, including terminator.
-			//
-			for (int i = 0; i < 14 && atm.header.filename[i]; ++i)
-			{
-				outByte(atm.header.filename[i]);
-			}
-			outByte(0x0d);
+	std::vector<renderjob> jobs;
+	planJobs(programs, starts, gap, *planner, timing, unnamed, jobs);
 
-			int blockLen = int(dataEnd - _rawData);
-			if (blockLen < 257)
-			{
-				// flags.7 cleared to indicate last block
-				//
-				flags &= ~_BV(7);
-			}
-			else if (blockLen > 256)
-			{
-				// Blocks are 256 bytes max.
-				//
-				blockLen = 256;
-			}
+	std::atomic<size_t> next(0);
 
-			/* - Header format:
-			<*>                      )
-			<*>                      )
-			<*>                      )
-			<*>                      ) Header preamble
-			<Filename>               ) Name is 1 to 13 bytes long
-			<Status Flag>            ) Bit 7 clear if last block
-			                         ) Bit 6 clear to skip block
-			                         ) Bit 5 clear if first block
-			<MSB block number>       ) Always zero
-			<LSB block number>
-			<Bytes in block>
-			<MSB run address>
-			<LSB run address>
-			<MSB block load address>
-			<LSB block load address>
-			*/
-
-			outByte(flags);
-			outByte(0);
-			outByte(blockNum & 0xff);
-			outByte(blockLen-1);
-			outByte((atm.header.exec & 0xff00) >> 8);
-			outByte(atm.header.exec & 0xff);
-			outByte((blockLoadAddr & 0xff00) >> 8);
-			outByte(blockLoadAddr & 0xff);
-
-			// Header/data gap is about 1 second. One out() call puts ~3.3ms of data.
-			//
-			headerTime = float(shortheaders ? 500 : 1000);
-			while(headerTime > 0.0)
-			{
-				out1();
-				headerTime -= 3.3F;
-			}
+	auto worker = [&]()
+	{
+		std::unique_ptr<freqout> fo(newFreqout(NULL, unused, bitsPerSample, sampleRate));
 
-			// Now for the data. You know you want it.
-			//
-			for (int i = 0; i < blockLen; ++i)
-			{
-				outByte(_rawData[i]);
-			}
+		for (size_t i = next++; i < jobs.size(); i = next++)
+		{
+			fo->_direct = data + headerBytes + jobs[i].sample * bytesPerSample;
+			renderJob(*fo, jobs[i], timing, unnamed);
+		}
+	};
 
-			// The checksum itself gets added to the internal count, but not
-			// until after it's written. It's reset again at the start of the
-			// loop. So go ahead, corrupt it all you like.
-			//
-			outByte(_checksum);
+	unsigned int cores = std::thread::hardware_concurrency();
+	size_t threadCount = cores ? cores : 1;
+	if (threadCount > jobs.size())
+	{
+		threadCount = jobs.size();
+	}
 
-			blockLoadAddr+= 0x100;
-			_rawData += 0x100;
-			++blockNum;
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < threadCount; ++i)
+	{
+		threads.push_back(std::thread(worker));
+	}
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i].join();
+	}
 
-			// flags.5 is clear on first block
-			//
-			flags |= _BV(5);
+	planner->_direct = data + headerBytes + starts.back() * bytesPerSample;
+	planner->writeTrailer(starts.back());
 
-			// Reset inter-block header time ready for leader tone at start of loop.
-			//
-			headerTime = float(shortheaders ? 500 : 1000);
-		}
+	map.close();
+	return true;
+}
 
-		return true;
+
+
+// FNV-1a, 64 bit. Plenty to tell whether a block has changed.
+//
+unsigned long long fnv(const void* data, size_t length, unsigned long long hash = 14695981039346656037ULL)
+{
+	const BYTE* bytes = (const BYTE*)data;
+	for (size_t i = 0; i < length; ++i)
+	{
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
 	}
+	return hash;
+}
 
+// Everything that goes into a job's samples, bar where it goes. If this
+// is the same as last time so are they.
+//
+unsigned long long jobHash(const renderjob& job, const tapetiming& timing, bool unnamed)
+{
+	if (job.gap)
+	{
+		return fnv(&job.gap, sizeof(job.gap));
+	}
 
+	if (unnamed)
+	{
+		const ATMHEADER* atm = (const ATMHEADER*)job.rawdata;
+		unsigned long long hash = fnv(&timing.lead, sizeof(timing.lead));
+		hash = fnv(&atm->start, sizeof(atm->start), hash);
+		return fnv(job.rawdata + sizeof(ATMHEADER), atm->length, hash);
+	}
 
+	const freqout::blockplan& block = job.block;
+	int fields[7] = { block.flags, block.number, block.length, block.execAddress, block.loadAddress, block.leaderTime, block.gapTime };
+	unsigned long long hash = fnv(block.name, strnlen(block.name, 14));
+	hash = fnv(fields, sizeof(fields), hash);
+	return fnv(block.data, block.length, hash);
+}
 
-	// Write atom formatted data to the wave file - unnamed mode
-	//
-	bool writeunnamed(bool shortheaders)
+
+// The block sidecar, kept alongside a WAV made with 'update' so the next
+// one can tell what's changed. A line that fixes the WAV's layout, then
+// a line per job: where it starts, its phase and its hash.
+//
+std::string sidecarLayout(int bitsPerSample, int sampleRate, long long samples, const std::vector<freqout::cuepoint>& cues)
+{
+	unsigned long long hash = fnv(NULL, 0);
+	for (size_t i = 0; i < cues.size(); ++i)
 	{
-		atmheader atm;
-		atm.read(_rawData);
+		hash = fnv(&cues[i].sample, sizeof(cues[i].sample), hash);
+		hash = fnv(cues[i].label.c_str(), cues[i].label.size() + 1, hash);
+	}
 
-		BYTE* dataEnd = _rawData + atm.header.length;
+	std::ostringstream layout;
+	layout << "atm2wav blocks " << bitsPerSample << " " << sampleRate << " " << samples << " " << cues.size() << " " << std::hex << hash;
+	return layout.str();
+}
+
+bool writeBlockSidecar(const std::string& name, const std::string& layout, const std::vector<renderjob>& jobs, const std::vector<unsigned long long>& hashes)
+{
+	std::ofstream sidecar(name.c_str());
+	if (!sidecar.is_open())
+	{
+		return false;
+	}
 
-		int blockLoadAddr = atm.header.start;
-		int blockEndAddr = blockLoadAddr + atm.header.length;
+	sidecar << layout << std::endl;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		sidecar << jobs[i].sample << " " << jobs[i].phase << " " << std::hex << hashes[i] << std::dec << std::endl;
+	}
+	return sidecar.good();
+}
 
-		// Initial header time about 4 1/2 seconds. One out() call puts ~3.3ms of data.
-		//
-		float headerTime = float(shortheaders ? 2500 : 4550);
-		while(headerTime > 0.0)
+// Which jobs need rendering again. False if the sidecar's missing or the
+// layout's changed, in which case it's all of them.
+//
+bool changedJobs(const std::string& name, const std::string& layout, const std::vector<renderjob>& jobs, const std::vector<unsigned long long>& hashes, std::vector<bool>& changed)
+{
+	std::ifstream sidecar(name.c_str());
+	std::string line;
+	if (!std::getline(sidecar, line) || line != layout)
+	{
+		return false;
+	}
+
+	changed.assign(jobs.size(), false);
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		long long sample;
+		int phase;
+		unsigned long long hash;
+		if (!(sidecar >> sample >> phase >> std::hex >> hash >> std::dec) || sample != jobs[i].sample || phase != jobs[i].phase)
 		{
-			out1();
-			headerTime -= 3.3F;
+			return false;
 		}
+		changed[i] = hash != hashes[i];
+	}
 
-		outByte(blockEndAddr / 256);
-		outByte(blockEndAddr % 256);
-		outByte(blockLoadAddr / 256);
-		outByte(blockLoadAddr % 256);
+	// Any more and it's a different tape.
+	//
+	return !(sidecar >> line);
+}
+
+// Renders the changed jobs over their old selves in the WAV.
+//
+bool updateTape(const std::string& outName, int headerBytes, const std::vector<renderjob>& jobs, const std::vector<bool>& changed, int bitsPerSample, int sampleRate, const tapetiming& timing, bool unnamed)
+{
+	std::fstream out(outName.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+	if (!out.is_open())
+	{
+		return false;
+	}
 
-		for (int i = 0; i < atm.header.length; ++i)
+	std::unique_ptr<freqout> fo(newFreqout(NULL, out, bitsPerSample, sampleRate));
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		if (changed[i])
 		{
-			outByte(_rawData[i]);
+			out.seekp(headerBytes + jobs[i].sample * (bitsPerSample / 8));
+			renderJob(*fo, jobs[i], timing, unnamed);
+			fo->flush();
 		}
-
-		return true;
 	}
 
+	out.flush();
+	return out.good();
+}
+
+
 
-	// NASTY HACK FOR WRITING WAVS. PLEASE LOOK AWAY NOW.
+// Checks the turbo half of a turbo tape, see freqout::writeTurbo. The
+// decoder works the faster bit model out from the leader and the first
+// few bytes, as it does for any tape, and back again at the next program.
+//
+bool verifyTurbo(cuts& likeAKnife, BYTE* rawdata, const std::string& name, int& blocks, std::string& problem)
+{
+	BYTE* data = rawdata;
+	atmheader atm;
+	atm.read(data);
 
-	void out32(int val)
+	if (!likeAKnife.findLeader())
 	{
-		char chars[4];
-		*(int*)chars = val;
-		_out << chars[0] << chars[1] << chars[2] << chars[3];
+		problem = name + " turbo: Didn't find leader tone.";
+		return false;
 	}
-
-	void out16(short val)
+	if (!likeAKnife.findStartBit())
 	{
-		char chars[2];
-		*(short*)chars = val;
-		_out << chars[0] << chars[1];
+		problem = name + " turbo: Didn't find start bit.";
+		return false;
 	}
+	likeAKnife.calibrate();
 
-	void createWaveFile()
+	for (int offset = 0; offset < atm.header.length; offset += 256)
 	{
-		// chunk descriptor
-		_out << "RIFF";
-		out32(0);			// dummy chunk size, will be overwritten
-		_out << "WAVE";
+		int blockLen = atm.header.length - offset < 256 ? atm.header.length - offset : 256;
+		std::string where = name + " turbo block " + std::to_string(offset / 256) + ": ";
+
+		BYTE byte;
+		if (!likeAKnife.getByte(byte) || byte != '*')
+		{
+			problem = where + "Failed reading '*'.";
+			return false;
+		}
+
+		likeAKnife.m_check = 0;
+		for (int i = 0; i < blockLen; ++i)
+		{
+			if (!likeAKnife.getByte(byte))
+			{
+				problem = where + "Failed reading data block.";
+				return false;
+			}
+			if (byte != data[offset + i])
+			{
+				problem = where + "Data doesn't match.";
+				return false;
+			}
+		}
 
-		// sub chunk descriptor
-		int BYTERATE = SAMPLERATE*(BITSPERSAMPLE / 8 * CHANNELS);
-		short BLOCKALIGN = BITSPERSAMPLE / 8 * CHANNELS;
-		_out << "fmt ";
-		out32(16);			// chunk size, bytes
-		out16(1);			// format, pcm uncompressed
-		out16(CHANNELS);
-		out32(SAMPLERATE);
-		out32(BYTERATE);
-		out16(BLOCKALIGN);		// block align
-		out16(BITSPERSAMPLE);
+		BYTE expected = likeAKnife.m_check;
+		if (!likeAKnife.getByte(byte) || byte != expected)
+		{
+			problem = where + "Checksum doesn't match.";
+			return false;
+		}
 
-		// chunk descriptor
-		_out << "data";
-		out32(0);			// dummy block length, will be overwritten
+		++blocks;
 	}
 
+	return true;
+}
+
+// Reads the tape back as it's made, with wav2atm's decoder, and checks
+// it's what went in. Every block in order, header, data and checksum,
+// and on a turbo tape the loader ahead of each program. 'blocks' says
+// how many were good.
+//
+bool verifyTape(tapesource& tape, int sampleRate, std::vector<std::vector<BYTE> >& programs, std::vector<std::vector<BYTE> >& loaders, const std::vector<std::string>& names, const tapetiming& timing, bool unnamed, int& blocks, std::string& problem)
+{
+	cuts likeAKnife(tape, sampleRate);
+
+	std::ostream unused(NULL);
+	freqoutT<pcm16> planner(NULL, unused, sampleRate);
 
-	void finaliseWaveFile()
+	blocks = 0;
+	for (size_t p = 0; p < programs.size(); ++p)
 	{
-		_out.seekp(40);
-		int bytesWrit = _writtenSampleCount * (_is8bit ? 1 : 2);
-		out32(bytesWrit);
+		planner._rawData = &programs[p].front();
+		planner._loader = loaders.empty() ? NULL : &loaders[p].front();
 
-		_out.seekp(4);
-		out32(bytesWrit + 36);
-	}
+		tapeblock block;
+		const char* error;
+
+		if (unnamed)
+		{
+			BYTE* data = planner._rawData;
+			atmheader atm;
+			atm.read(data);
 
-	// OK IT'S SAFE TO LOOK AGAIN
+			int startAddr = atm.header.start;
+			int endAddr = startAddr + atm.header.length;
 
-	bool _is8bit;
+			if (likeAKnife.readBlock(block, error) || error != NULL)
+			{
+				problem = names[p] + ": " + (error ? error : "Found a named block.");
+				return false;
+			}
 
-	short _sine[147];
+			BYTE address[4] = { (BYTE)(endAddr >> 8), (BYTE)endAddr, (BYTE)(startAddr >> 8), (BYTE)startAddr };
+			if (memcmp(block.preamble, address, 4) != 0)
+			{
+				problem = names[p] + ": Address header doesn't match.";
+				return false;
+			}
 
-	BYTE* _rawData;
+			for (int i = 0; i < atm.header.length; ++i)
+			{
+				BYTE byte;
+				if (!likeAKnife.getByte(byte))
+				{
+					problem = names[p] + ": Failed reading data.";
+					return false;
+				}
+				if (byte != data[i])
+				{
+					problem = names[p] + ": Data doesn't match.";
+					return false;
+				}
+			}
 
-	int _writtenSampleCount;
+			++blocks;
+			continue;
+		}
 
-	BYTE _checksum;
+		std::vector<freqout::blockplan> plan;
+		planner.planBlocks(timing, plan);
 
-	std::ofstream& _out;
+		for (size_t b = 0; b < plan.size(); ++b)
+		{
+			const freqout::blockplan& want = plan[b];
+			std::string where = names[p] + " block " + std::to_string(b) + ": ";
 
-	static const int CHANNELS = 1;
-	static const int SAMPLERATE = 44100;
-	int BITSPERSAMPLE;
-};
+			if (!likeAKnife.readBlock(block, error))
+			{
+				problem = where + (error ? error : "Failed reading preamble.");
+				return false;
+			}
 
+			if (std::string((const char*)block.name) != std::string(want.name, planner.nameLength(want.name))
+				|| block.header.flags != want.flags
+				|| block.blockNum() != want.number
+				|| block.length() != want.length
+				|| block.runAddress() != (want.execAddress & 0xffff)
+				|| block.loadAddress() != (want.loadAddress & 0xffff))
+			{
+				problem = where + "Header doesn't match.";
+				return false;
+			}
 
-class freqout8 : public freqout
-{
-public:
-	freqout8(BYTE* rawdata, std::ofstream& out) :
-		freqout(rawdata, out)
-	{
-		_is8bit = true;
-		BITSPERSAMPLE = 8;
-	}
+			if (memcmp(block.data, want.data, want.length) != 0)
+			{
+				problem = where + "Data doesn't match.";
+				return false;
+			}
 
-	// Output a 1 bit, 8 cycles of 24khz
-	//
-	virtual void out1(void)
-	{
-		for (int i = 0; i < 147; ++i)
+			++blocks;
+		}
+
+		if (planner._loader && !verifyTurbo(likeAKnife, planner._rawData, names[p], blocks, problem))
 		{
-			// Double step the table for a higher frequency
-			//
-			short val = _sine[(i * 2) % 147];
-			_out.put(val < 0 ? (unsigned char)0x40 : (unsigned char)0xc0);
+			return false;
 		}
-		_writtenSampleCount += 147;
 	}
 
-	// Output a 0 bit, 4 cycles of 12khz
-	//
-	virtual void out0(void)
+	return true;
+}
+
+
+
+// m:ss.sss for a stretch of tape 'samples' long.
+//
+std::string playTime(long long samples, int sampleRate)
+{
+	long long ms = (samples * 1000 + sampleRate / 2) / sampleRate;
+
+	std::ostringstream text;
+	text << ms / 60000 << ":" << std::setfill('0') << std::setw(2) << ms / 1000 % 60 << "." << std::setw(3) << ms % 1000;
+	return text.str();
+}
+
+
+
+// The cue points again, for tools that would rather not dig them out of
+// the WAV.
+//
+bool writeCueSidecar(const std::string& name, const std::vector<freqout::cuepoint>& cues, long long samples, int sampleRate)
+{
+	std::ofstream json(name.c_str());
+	if (!json.is_open())
 	{
-		for (int i = 0; i < 147; ++i)
-		{
-			short val = _sine[i];
-			_out.put(val < 0 ? (unsigned char)0x40 : (unsigned char)0xc0);
-		}
-		_writtenSampleCount += 147;
+		return false;
 	}
-};
 
+	json << "{" << std::endl;
+	json << "\t\"sampleRate\": " << sampleRate << "," << std::endl;
+	json << "\t\"samples\": " << samples << "," << std::endl;
+	json << "\t\"cues\": [" << std::endl;
+	for (size_t i = 0; i < cues.size(); ++i)
+	{
+		const freqout::cuepoint& cue = cues[i];
+		json << "\t\t{ \"id\": " << i + 1
+			<< ", \"sample\": " << cue.sample
+			<< ", \"time\": " << jsonString(playTime(cue.sample, sampleRate))
+			<< ", \"block\": " << cue.block
+			<< ", \"part\": " << jsonString(cue.part)
+			<< ", \"label\": " << jsonString(cue.label)
+			<< " }" << (i + 1 < cues.size() ? "," : "") << std::endl;
+	}
+	json << "\t]" << std::endl;
+	json << "}" << std::endl;
 
+	return json.good();
+}
 
 
 
@@ -448,83 +667,497 @@ int main(int argc, char** argv)
 		std::cout << "ATM2WAV V" << VSNSTR << std::endl;
 		std::cout << std::endl;
 		std::cout << "Produces a WAV representing a cassette image of the supplied ATM." << std::endl;
-		std::cout << "WAV will be 44.1khz, 16 bit, mono." << std::endl;
+		std::cout << "WAV will be 44.1khz, 16 bit, mono unless told otherwise." << std::endl;
 		std::cout << std::endl;
 		std::cout << "Usage: atm2wav atmfile[.atm] [options]" << std::endl;
+		std::cout << "       atm2wav @listfile [options]" << std::endl;
+		std::cout << std::endl;
+		std::cout << "A list file names several ATMs, one per line, to go on one tape." << std::endl;
 		std::cerr << std::endl;
 		std::cerr << "Options:";
 		std::cerr << std::endl;
-		std::cerr << "out=     Output filename. Optional, defaults to <infile>.wav" << std::endl;
+		std::cerr << "out=     Output filename. Optional, defaults to <infile>.wav, .w64, .csw or .uef" << std::endl;
+		std::cerr << "         out=- writes the WAV to stdout." << std::endl;
 		std::cerr << "unnamed  Save as unnamed file." << std::endl;
 		std::cerr << "8bit     Save as 8 bit unsigned WAV." << std::endl;
-		std::cout << "short    Short headers - 3 sec. instead of 5, reduced inter-block gap." << std::endl;
+		std::cerr << "24bit    Save as 24 bit WAV." << std::endl;
+		std::cerr << "float    Save as 32 bit float WAV." << std::endl;
+		std::cerr << "w64      Save as Sony Wave64, no cue points. WAVs over 4GB are RF64" << std::endl;
+		std::cerr << "         without asking." << std::endl;
+		std::cerr << "rate=    Sample rate in hz, 8000 to 192000. 11025 8bit makes for small tapes." << std::endl;
+		std::cerr << "csw      Save as a CSW (compressed square wave) v2 image instead of a WAV." << std::endl;
+		std::cerr << "uef      Save as a UEF emulator tape image instead of a WAV." << std::endl;
+		std::cerr << "gzip     Gzip the UEF." << std::endl;
+		std::cout << "short    Short headers - 2.5 sec. instead of 4.5, reduced inter-block gap." << std::endl;
+		std::cout << "profile= Leader and gap timing: standard, short or minimum." << std::endl;
+		std::cout << "lead=    First block's leader in ms. Overrides the profile." << std::endl;
+		std::cout << "blocklead= Later blocks' leaders in ms." << std::endl;
+		std::cout << "datagap= Tone between each block header and its data in ms." << std::endl;
+		std::cout << "time     Just say how long the tape takes to load, write nothing." << std::endl;
+		std::cout << "nocues   Leave out the WAV cue points marking each block's leader," << std::endl;
+		std::cout << "         header and data." << std::endl;
+		std::cout << "cues=    Also write the cue points to this JSON file." << std::endl;
+		std::cout << "verify   Decode the WAV as it's written and check it matches the ATMs." << std::endl;
+		std::cout << "         The WAV's written in one go, not in parallel. Any rate= will do," << std::endl;
+		std::cout << "         11025 8bit included." << std::endl;
+		std::cout << "turbo    Put a turbo loader on the tape ahead of each program, which then" << std::endl;
+		std::cout << "         goes at 1200 baud. *RUN it as usual, it loads 4 times as fast." << std::endl;
+		std::cout << "gap=     Silence between programs on a compilation in ms, default 2000." << std::endl;
+		std::cout << "mmap     Render all the blocks at once, straight into a memory mapped WAV." << std::endl;
+		std::cout << "update   Only re-render the blocks that have changed since the WAV was" << std::endl;
+		std::cout << "         last made with update. Block hashes are kept in <out>.blocks." << std::endl;
 		return 1;
 	}
 
-	// todo: add support for unnamed files
-
+	// The WAV can go to stdout, to be piped somewhere. Chat goes to stderr then.
+	//
+	std::string outName;
+	bool haveOutName = param.getstring("out", outName);
+	bool toStdout = haveOutName && outName == "-";
+	bool csw = param.ispresent("csw");
+	bool uef = param.ispresent("uef");
+	bool wave64 = param.ispresent("w64") && !csw && !uef;
+	std::ostream& msg = toStdout ? std::cerr : std::cout;
+
+	// One program, or a compilation of them listed in a file, one to a
+	// line.
+	//
 	std::string inName = argv[1];
-	std::ifstream in(inName.c_str(), std::ios_base::in | std::ios_base::binary);
-	if (!in.is_open())
+	std::vector<std::string> inNames;
+	if (inName[0] == '@')
 	{
-		inName += ".atm";
-		in.open(inName.c_str(), std::ios_base::in | std::ios_base::binary);
-		if (!in.is_open())
+		inName = inName.substr(1);
+		std::ifstream list(inName.c_str());
+		if (!list.is_open())
+		{
+			msg << "Invalid list file " << inName.c_str() << "." << std::endl;
+			return 1;
+		}
+
+		std::string line;
+		while (std::getline(list, line))
+		{
+			size_t end = line.find_last_not_of(" \t\r");
+			if (end != std::string::npos && line[0] != '#')
+			{
+				inNames.push_back(line.substr(0, end + 1));
+			}
+		}
+
+		if (inNames.empty())
+		{
+			msg << "Nothing in list file " << inName.c_str() << "." << std::endl;
+			return 1;
+		}
+	}
+	else
+	{
+		inNames.push_back(inName);
+	}
+
+	// Read the .atms into ram
+	//
+	std::vector<std::vector<BYTE> > programs(inNames.size());
+	for (size_t i = 0; i < inNames.size(); ++i)
+	{
+		if (!readatm(inNames[i], programs[i]))
 		{
-			std::cout << "Invalid input file " << argv[1] << "." << std::endl;
+			msg << "Invalid input file " << inNames[i].c_str() << "." << std::endl;
 			return 1;
 		}
 	}
 
-	std::string outName;
-	if (!param.getstring("out", outName))
+	if (!haveOutName)
 	{
-		outName = inName;
-		outName += ".wav";
+		outName = inNames.size() == 1 ? inNames[0] : inName;
+		outName += csw ? ".csw" : uef ? ".uef" : wave64 ? ".w64" : ".wav";
 	}
 
-	// Prepare output.
+	int sampleRate = 44100;
+	param.getint("rate", sampleRate);
+	if (sampleRate < 8000 || sampleRate > 192000)
+	{
+		msg << "Sample rate should be 8000 to 192000hz." << std::endl;
+		return 1;
+	}
+
+	// Silence between programs, in ms.
 	//
-	std::ofstream out(outName.c_str(), std::ios_base::out);
-	if (!out.is_open())
+	int gap = 2000;
+	param.getint("gap", gap);
+	if (gap < 0)
+	{
+		gap = 0;
+	}
+
+	// How much leader and gap. A profile, any part of which can be
+	// overridden.
+	//
+	tapetiming timing = param.ispresent("short") ? TIMING_SHORT : TIMING_STANDARD;
+	std::string profile;
+	if (param.getstring("profile", profile))
+	{
+		if (profile == "standard")
+		{
+			timing = TIMING_STANDARD;
+		}
+		else if (profile == "short")
+		{
+			timing = TIMING_SHORT;
+		}
+		else if (profile == "minimum")
+		{
+			timing = TIMING_MINIMUM;
+		}
+		else
+		{
+			msg << "Unknown profile " << profile.c_str() << ", should be standard, short or minimum." << std::endl;
+			return 1;
+		}
+	}
+	param.getint("lead", timing.lead);
+	param.getint("blocklead", timing.leader);
+	param.getint("datagap", timing.gap);
+	if (timing.lead < 0 || timing.leader < 0 || timing.gap < 0)
 	{
-		std::cout << "Invalid output file " << outName.c_str() << std::endl;
+		msg << "Leader and gap times can't be negative." << std::endl;
 		return 1;
 	}
 
+	bool unnamed = param.ispresent("unnamed");
 
-	// Read the .atm into ram
+	// A turbo tape is each program's loader, then the program itself in
+	// turbo blocks.
 	//
-	in.seekg(0, std::ios_base::end);
-	std::vector<BYTE> byteBuffer((unsigned int)(in.tellg()));
-	in.seekg(0, std::ios_base::beg);
+	bool turbo = param.ispresent("turbo");
+	std::vector<std::vector<BYTE> > loaders(turbo ? programs.size() : 0);
+	if (turbo && (unnamed || uef))
+	{
+		msg << "Turbo tapes are named and audio, not unnamed or UEF." << std::endl;
+		return 1;
+	}
+	if (turbo && sampleRate < 22050)
+	{
+		// 4800hz is barely a couple of samples a cycle below that.
+		//
+		msg << "Turbo tapes need a sample rate of 22050hz or more." << std::endl;
+		return 1;
+	}
+	for (size_t i = 0; i < loaders.size(); ++i)
+	{
+		if (!makeTurboLoader(&programs[i].front(), loaders[i]))
+		{
+			msg << "Can't turbo load " << inNames[i].c_str() << ", it's empty or loads over the loader at #"
+				<< std::hex << std::uppercase << std::setfill('0') << std::setw(4) << TURBO_WORKSPACE << "-#"
+				<< std::setw(4) << TURBO_LOADADDR + sizeof(TURBO_LOADER) - 1 << std::dec << "." << std::endl;
+			return 1;
+		}
+	}
+
+	int bitsPerSample = 16;
+	if (param.ispresent("8bit"))
+	{
+		bitsPerSample = 8;
+	}
+	else if (param.ispresent("24bit"))
+	{
+		bitsPerSample = 24;
+	}
+	else if (param.ispresent("float"))
+	{
+		bitsPerSample = 32;
+	}
+
+	// Every program's length is known before a sample's made, so the
+	// header can go first and each program knows where it starts.
+	//
+	std::ofstream file;
+	std::unique_ptr<freqout> planner(newFreqout(NULL, file, bitsPerSample, sampleRate));
+	planner->_wave64 = wave64;
+
+	std::vector<long long> starts(programs.size() + 1);
+	starts[0] = 0;
+	for (size_t i = 0; i < programs.size(); ++i)
+	{
+		planner->_rawData = &programs[i].front();
+		planner->_loader = turbo ? &loaders[i].front() : NULL;
+		long long samples = planner->tapeSamples(timing, unnamed);
+		if (i + 1 < programs.size())
+		{
+			samples += planner->gapSamples(gap);
+		}
+		starts[i + 1] = starts[i] + samples;
+	}
+
+	if (programs.size() > 1)
+	{
+		for (size_t i = 0; i < programs.size(); ++i)
+		{
+			msg << "  " << playTime(starts[i], sampleRate) << "  " << inNames[i].c_str() << std::endl;
+		}
+	}
+	msg << "Load time " << playTime(starts.back(), sampleRate) << "." << std::endl;
 
-	BYTE* rawdata = &byteBuffer.front();
-	in.read((char*)rawdata, (std::streamsize)byteBuffer.size());
+	// Where every block's leader, header and data start, so a block that
+	// won't load can be found without scrubbing through the lot.
+	//
+	std::vector<freqout::cuepoint> cues;
+	for (size_t i = 0; i < programs.size(); ++i)
+	{
+		planner->_rawData = &programs[i].front();
+		planner->_loader = turbo ? &loaders[i].front() : NULL;
+		planner->planCues(timing, unnamed, starts[i], inNames[i], cues);
+	}
 
-	freqout* fo = param.ispresent("8bit") ? new freqout8(rawdata, out) : new freqout(rawdata, out);
-	fo->createWaveFile();
+	std::string cueName;
+	if (param.getstring("cues", cueName) && !writeCueSidecar(cueName, cues, starts.back(), sampleRate))
+	{
+		msg << "Couldn't write cue file " << cueName.c_str() << "." << std::endl;
+		return 1;
+	}
 
-	bool written;
-	if (param.ispresent("unnamed"))
+	if (param.ispresent("nocues"))
 	{
-		written = fo->writeunnamed(param.ispresent("short"));
+		cues.clear();
+	}
+
+	if (param.ispresent("time"))
+	{
+		return 0;
+	}
+
+	// An update renders just the blocks that have changed since last time,
+	// over the top of the old ones. That needs the tape laid out the same
+	// way, sample for sample, and the old WAV still there.
+	//
+	bool update = param.ispresent("update") && !toStdout && !csw && !uef && !turbo && !param.ispresent("verify");
+	std::string sidecarName = outName + ".blocks";
+	std::string layout;
+	std::vector<renderjob> jobs;
+	std::vector<unsigned long long> hashes;
+	if (update)
+	{
+		planJobs(programs, starts, gap, *planner, timing, unnamed, jobs);
+		for (size_t i = 0; i < jobs.size(); ++i)
+		{
+			hashes.push_back(jobHash(jobs[i], timing, unnamed));
+		}
+		layout = sidecarLayout(bitsPerSample, sampleRate, starts.back(), cues);
+
+		planner->_cues = cues;
+		long long wavBytes = planner->waveFileBytes(starts.back());
+
+		std::ifstream old(outName.c_str(), std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+		std::vector<bool> changed;
+		if (old.is_open() && (long long)old.tellg() == wavBytes && changedJobs(sidecarName, layout, jobs, hashes, changed))
+		{
+			old.close();
+
+			int blocks = 0;
+			int changedBlocks = 0;
+			for (size_t i = 0; i < jobs.size(); ++i)
+			{
+				if (!jobs[i].gap)
+				{
+					++blocks;
+					changedBlocks += changed[i] ? 1 : 0;
+				}
+			}
+
+			if (!updateTape(outName, planner->waveHeaderBytes(starts.back()), jobs, changed, bitsPerSample, sampleRate, timing, unnamed)
+				|| !writeBlockSidecar(sidecarName, layout, jobs, hashes))
+			{
+				msg << "Failed to update " << outName.c_str() << "." << std::endl;
+				return 1;
+			}
+
+			msg << "Updated " << changedBlocks << " of " << blocks << (blocks == 1 ? " block" : " blocks") << " in '" << outName.c_str() << "'." << std::endl;
+			return 0;
+		}
+
+		msg << "Layout's changed or there's nothing to update, writing it all." << std::endl;
+	}
+
+	// Prepare output.
+	//
+	if (toStdout)
+	{
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	}
+	else
+	{
+		file.open(outName.c_str(), std::ios_base::out | std::ios_base::binary);
+		if (!file.is_open())
+		{
+			msg << "Invalid output file " << outName.c_str() << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& out = toStdout ? std::cout : file;
+
+	freqout* fo;
+	if (csw)
+	{
+		fo = new cswout(NULL, out, sampleRate);
+	}
+	else if (uef)
+	{
+		fo = new uefout(NULL, out, param.ispresent("gzip"));
 	}
 	else
 	{
-		written = fo->write(param.ispresent("short"));
+		fo = newFreqout(NULL, out, bitsPerSample, sampleRate);
+		fo->_cues = cues;
+		fo->_wave64 = wave64;
+	}
+
+	// Verifying reads the samples back as they're made, on another
+	// thread, so they have to be made in order.
+	//
+	bool verify = param.ispresent("verify") && !csw && !uef;
+	queuetape tape;
+	bool verified = false;
+	int verifiedBlocks = 0;
+	std::string problem;
+	std::thread checker;
+	if (verify)
+	{
+		fo->_tap = &tape;
+		checker = std::thread([&]()
+		{
+			verified = verifyTape(tape, sampleRate, programs, loaders, inNames, timing, unnamed, verifiedBlocks, problem);
+			tape.close();
+		});
+	}
+
+	// A mapping can fail where a stream won't, a 2GB WAV is too big for a
+	// 32 bit address space. Then it's written the usual way instead.
+	//
+	bool written = true;
+	bool mapped = false;
+	if (param.ispresent("mmap") && verify)
+	{
+		msg << "Verifying writes the WAV in order, so it won't be memory mapped." << std::endl;
+	}
+	else if (param.ispresent("mmap") && !toStdout && !csw && !uef && !turbo)
+	{
+		file.close();
+		mapped = renderMapped(outName, programs, starts, gap, bitsPerSample, sampleRate, timing, unnamed, cues, wave64);
+		if (!mapped)
+		{
+			msg << "Couldn't map " << outName.c_str() << ", writing it without." << std::endl;
+			file.open(outName.c_str(), std::ios_base::out | std::ios_base::binary);
+			written = file.is_open();
+		}
+	}
+
+	if (mapped || !written)
+	{
+		// Done, or there's nothing to write to.
+		//
+	}
+	else if (programs.size() > 1 && !verify && !toStdout && !csw && !uef && !turbo)
+	{
+		// A WAV compilation going to a file gets rendered in parallel,
+		// each program straight into its own stretch of the file.
+		//
+		fo->createWaveFile(starts.back());
+		fo->flush();
+		file.close();
+
+		int headerBytes = fo->waveHeaderBytes(starts.back());
+		int bytesPerSample = bitsPerSample / 8;
+
+		std::vector<compilationpart> parts(programs.size());
+		for (size_t i = 0; i < programs.size(); ++i)
+		{
+			parts[i].rawdata = &programs[i].front();
+			parts[i].offset = headerBytes + starts[i] * bytesPerSample;
+			parts[i].gap = i + 1 < programs.size() ? gap : 0;
+		}
+
+		written = renderCompilation(outName, parts, bitsPerSample, sampleRate, timing, unnamed);
+
+		// And the cue points on the end.
+		//
+		std::ofstream tail(outName.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+		tail.seekp(headerBytes + starts.back() * bytesPerSample);
+
+		std::unique_ptr<freqout> cuewriter(newFreqout(NULL, tail, bitsPerSample, sampleRate));
+		cuewriter->_cues = cues;
+		cuewriter->_wave64 = wave64;
+		cuewriter->writeTrailer(starts.back());
+		cuewriter->flush();
+		written = written && tail.good();
+	}
+	else
+	{
+		fo->createWaveFile(starts.back());
+		for (size_t i = 0; i < programs.size() && written; ++i)
+		{
+			fo->_rawData = &programs[i].front();
+			fo->_loader = turbo ? &loaders[i].front() : NULL;
+			written = unnamed ? fo->writeunnamed(timing) : fo->write(timing);
+			if (i + 1 < programs.size())
+			{
+				fo->outGap(gap);
+			}
+		}
+
+		if (written)
+		{
+			fo->finaliseWaveFile();
+		}
+	}
+
+	if (verify)
+	{
+		tape.finish();
+		checker.join();
 	}
 
 	if (!written)
 	{
-		std::cout << "Failed to write WAV." << std::endl;
-		_unlink(outName.c_str());
+		msg << "Failed to write WAV." << std::endl;
+		if (!toStdout)
+		{
+			_unlink(outName.c_str());
+		}
 		return 1;
 	}
 
-	fo->finaliseWaveFile();
+	// Without update any old block hashes no longer describe the WAV.
+	//
+	if (update && !writeBlockSidecar(sidecarName, layout, jobs, hashes))
+	{
+		msg << "Couldn't write block file " << sidecarName.c_str() << "." << std::endl;
+		return 1;
+	}
+	else if (!update && !toStdout)
+	{
+		_unlink(sidecarName.c_str());
+	}
 
-	std::cout << "Written Atom program to '" << outName.c_str() << "'." << std::endl;
+	if (programs.size() > 1)
+	{
+		msg << "Written " << programs.size() << " Atom programs to '" << (toStdout ? "stdout" : outName.c_str()) << "'." << std::endl;
+	}
+	else
+	{
+		msg << "Written Atom program to '" << (toStdout ? "stdout" : outName.c_str()) << "'." << std::endl;
+	}
+
+	if (verify)
+	{
+		if (!verified)
+		{
+			msg << "Verify failed. " << problem.c_str() << std::endl;
+			return 1;
+		}
+		msg << "Verified " << verifiedBlocks << (verifiedBlocks == 1 ? " block." : " blocks.") << std::endl;
+	}
 
 	return 0;
 }
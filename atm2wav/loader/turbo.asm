@@ -0,0 +1,167 @@
+; Turbo loader for atm2wav's 'turbo' tapes.
+;
+; Goes on the tape as an ordinary 300 baud program, *RUN it and it reads
+; the rest of the tape at 1200 baud: a 1 is 4 cycles of 4800hz, a 0 is 2
+; cycles of 2400hz, bytes framed with start and stop bits as usual.
+;
+; After the leader comes one block per 256 bytes of program, each a '*'
+; to sync on, the data, and a checksum, the sum of the data bytes.
+; Blocks run straight on one from another. atm2wav fills in the
+; parameters below for the program it's loading.
+;
+; Assembles with xa: xa -o turbo.bin turbo.asm
+; turbo.bin is what atm2wav carries, see shared/turboloader.h.
+;
+; Timing is by counting round a polling loop, the Atom has no timer to
+; spare. At 1Mhz one time round edge is 14 cycles, so a half cycle counts
+; 5 or so at 4800hz and 13 at 2400hz, a whole cycle 10 and 25. The
+; thresholds sit between those with room for tapes 15% fast or slow.
+
+tape	= $b002		; 8255 port C, bit 5 is the cassette input
+oswrch	= $fff4
+oscrlf	= $ffed
+
+ptr	= $80		; where the next block goes
+sum	= $82		; block checksum
+value	= $83		; byte being read
+bits	= $84		; bits left to read
+halves	= $85		; half cycles left in the bit
+span	= $86		; half cycles the bit had
+level	= $87		; last level seen on the input
+blocks	= $88		; blocks left to read
+count	= $89		; bytes in this block, 0 for 256
+
+HALF	= 11		; a half cycle counting this or more is 2400hz
+CYCLE	= 18		; likewise a whole cycle
+
+	* = $0300
+
+	jmp entry
+
+; Filled in by atm2wav.
+;
+start	.word 0		; load address
+exec	.word 0		; run address
+nblocks	.byt 0		; number of blocks
+last	.byt 0		; bytes in the last one, 0 for 256
+
+entry	sei
+	lda start
+	sta ptr
+	lda start+1
+	sta ptr+1
+	lda nblocks
+	sta blocks
+	lda tape
+	and #$20
+	sta level
+
+	; Anything before the first sync is leader, or noise as the tape
+	; gets going.
+	;
+hunt	jsr getbyte
+	cmp #'*'
+	bne hunt
+	beq first
+
+block	jsr getbyte
+	cmp #'*'
+	bne bad
+
+first	lda #0
+	ldx blocks
+	dex
+	bne full
+	lda last
+full	sta count
+
+	ldy #0
+	sty sum
+data	jsr getbyte
+	sta (ptr),y
+	clc
+	adc sum
+	sta sum
+	iny
+	cpy count
+	bne data
+
+	jsr getbyte
+	cmp sum
+	bne bad
+
+	inc ptr+1
+	dec blocks
+	bne block
+
+	cli
+	jmp (exec)
+
+bad	jsr oscrlf
+	ldx #0
+msg	lda text,x
+	beq stop
+	jsr oswrch
+	inx
+	bne msg
+stop	cli
+	brk
+
+text	.asc "TURBO LOAD FAILED"
+	.byt 0
+
+
+; A byte. Hunts for the start bit, the first half cycle of low tone,
+; then reads 8 bits lsb first. Leaves the stop bit for the next hunt.
+; Keeps Y.
+;
+getbyte	ldx #0
+	jsr edge
+	cpx #HALF
+	bcc getbyte
+
+	lda #3
+	sta halves
+gb1	jsr edge
+	dec halves
+	bne gb1
+
+	lda #8
+	sta bits
+gb2	jsr getbit
+	ror value
+	dec bits
+	bne gb2
+	lda value
+	rts
+
+; A bit into carry. Its first whole cycle says which tone it is, then
+; the rest of it's counted off.
+;
+getbit	ldx #0
+	jsr edge
+	jsr edge
+	lda #6
+	cpx #CYCLE
+	bcc gt1
+	lda #2
+gt1	sta halves
+	sta span
+gt2	jsr edge
+	dec halves
+	bne gt2
+	lda span
+	cmp #4
+	rts
+
+; Waits for the input to change, counting in X as it goes.
+;
+edge	inx
+	lda tape
+	eor level
+	and #$20
+	beq edge
+	lda level
+	eor #$20
+	sta level
+	rts
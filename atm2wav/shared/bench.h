@@ -0,0 +1,95 @@
+#ifndef __bench_h
+#define __bench_h
+
+// Timing for the benchmarks, cutsbench and freqbench.
+//
+// Include this before shared/defines.h, windows.h wants BYTE and friends
+// for its own typedefs.
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#define HAVE_RDTSC
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+
+// Pin ourselves to one core so the timings aren't at the mercy of the scheduler.
+//
+inline bool pinToCpu(int cpu)
+{
+#ifdef _WIN32
+	return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#endif
+}
+
+
+inline unsigned long long cycleCount(void)
+{
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+
+
+struct timing
+{
+	double best;
+	double median;
+	unsigned long long bestCycles;
+	long long items;
+};
+
+
+// Runs one test 'trials' times. The test returns how many things it did,
+// which had better be the same every time.
+//
+template <class TEST>
+timing runTrials(TEST test, int trials)
+{
+	std::vector<double> times;
+	timing t;
+	t.bestCycles = ~0ULL;
+	t.items = 0;
+
+	for (int i = 0; i < trials; ++i)
+	{
+		unsigned long long c0 = cycleCount();
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+		t.items = test();
+
+		std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+		unsigned long long c1 = cycleCount();
+
+		times.push_back(std::chrono::duration<double>(t1 - t0).count());
+		t.bestCycles = std::min(t.bestCycles, c1 - c0);
+	}
+
+	std::sort(times.begin(), times.end());
+	t.best = times.front();
+	t.median = times[times.size() / 2];
+	return t;
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef __cswfile_h
+#define __cswfile_h
+
+#include <istream>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+
+#include "tapesource.h"
+#include "gzip.h"
+
+// CSW, compressed square wave. Rather than samples a CSW keeps the length
+//  of each pulse (half cycle), which is just what the decoder counts out
+//  of samples anyway. So a CSW tape hands them over as they are and cuts
+//  never has to look for a crossing.
+//
+// Needs shared/defines.h.
+
+
+// A tape of pulses. Positions are still in samples, as for any other
+//  tape, so it can be fetched from like one too, though the decoder
+//  takes the pulses straight.
+//
+class pulsetape : public tapesource
+{
+public:
+	pulsetape() :
+		m_startHigh(false),
+		m_base(0)
+	{
+		m_starts.push_back(0);
+	}
+
+	void add(size_t length)
+	{
+		if (length)
+		{
+			m_pulses.push_back((DWORD)length);
+			m_starts.push_back(m_starts.back() + length);
+		}
+	}
+
+	size_t length(void) const
+	{
+		return m_starts.back();
+	}
+
+	// The pulse sample 'pos' falls in. pulseCount() if it's off the end.
+	//
+	size_t pulseAt(size_t pos) const
+	{
+		return std::upper_bound(m_starts.begin(), m_starts.end(), pos) - m_starts.begin() - 1;
+	}
+
+	size_t pulseCount(void) const
+	{
+		return m_pulses.size();
+	}
+
+	virtual const pulsetape* pulses(void) const
+	{
+		return this;
+	}
+
+	// Samples for anything that wants them, square at half volume.
+	//
+	virtual size_t fetch(size_t pos, const short*& samples, size_t want = 1)
+	{
+		samples = NULL;
+		if (pos >= length())
+		{
+			return 0;
+		}
+
+		if (pos < m_base || pos + want > m_base + m_samples.size())
+		{
+			size_t n = want > BUFFERSAMPLES ? want : BUFFERSAMPLES;
+			n = n < length() - pos ? n : length() - pos;
+			m_samples.resize(n);
+			m_base = pos;
+
+			size_t pulse = pulseAt(pos);
+			for (size_t i = 0; i < n; ++pulse)
+			{
+				short level = ((pulse & 1) == 0) == m_startHigh ? 16384 : -16384;
+				size_t end = m_starts[pulse + 1] - m_base;
+				for (; i < n && i < end; ++i)
+				{
+					m_samples[i] = level;
+				}
+			}
+		}
+
+		samples = &m_samples[pos - m_base];
+		return m_base + m_samples.size() - pos;
+	}
+
+	std::vector<DWORD> m_pulses;
+	std::vector<size_t> m_starts;
+	bool m_startHigh;
+
+private:
+	static const size_t BUFFERSAMPLES = 1 << 16;
+
+	std::vector<short> m_samples;
+	size_t m_base;
+};
+
+
+// Run length coded pulses, as both versions have them: a byte each, or a
+//  0 and 4 bytes for anything over 255 samples.
+//
+inline bool readcswpulses(const BYTE* data, size_t length, pulsetape& tape)
+{
+	// No more pulses than bytes.
+	//
+	tape.m_pulses.reserve(tape.m_pulses.size() + length);
+	tape.m_starts.reserve(tape.m_starts.size() + length);
+
+	for (size_t i = 0; i < length; )
+	{
+		if (data[i])
+		{
+			tape.add(data[i++]);
+			continue;
+		}
+
+		if (i + 5 > length)
+		{
+			return false;
+		}
+		tape.add(data[i + 1] | (data[i + 2] << 8) | (data[i + 3] << 16) | ((DWORD)data[i + 4] << 24));
+		i += 5;
+	}
+	return true;
+}
+
+
+// Reads a CSW, v1 or v2. v1 is always plain RLE, v2 can be Z-RLE, the
+//  same again deflated.
+// Returns false with a reason in 'error' if the file's no good to us.
+//
+inline bool readcsw(std::istream& in, pulsetape& tape, int& sampleRate, const char*& error)
+{
+	in.seekg(0, std::ios_base::end);
+	std::vector<BYTE> file(size_t(in.tellg()));
+	in.seekg(0);
+	if (!file.empty())
+	{
+		in.read((char*)&file[0], (std::streamsize)file.size());
+	}
+
+	if (!in || file.size() < 0x20 || memcmp(&file[0], "Compressed Square Wave\x1a", 23) != 0)
+	{
+		error = "Not a CSW file.";
+		return false;
+	}
+
+	BYTE major = file[0x17];
+	size_t dataStart;
+	int compression;
+	int flags;
+	if (major == 1)
+	{
+		sampleRate = file[0x19] | (file[0x1a] << 8);
+		compression = file[0x1b];
+		flags = file[0x1c];
+		dataStart = 0x20;
+	}
+	else if (major == 2)
+	{
+		if (file.size() < 0x34)
+		{
+			error = "Not a CSW file.";
+			return false;
+		}
+		sampleRate = file[0x19] | (file[0x1a] << 8) | (file[0x1b] << 16) | (file[0x1c] << 24);
+		compression = file[0x21];
+		flags = file[0x22];
+		dataStart = 0x34 + file[0x23];
+	}
+	else
+	{
+		error = "Unknown CSW version.";
+		return false;
+	}
+
+	if (sampleRate <= 0 || dataStart > file.size())
+	{
+		error = "Bad CSW header.";
+		return false;
+	}
+
+	tape.m_startHigh = (flags & 1) != 0;
+
+	const BYTE* data = file.empty() ? NULL : &file[0] + dataStart;
+	size_t length = file.size() - dataStart;
+
+	std::vector<BYTE> inflated;
+	if (compression == 2 && major == 2)
+	{
+		if (!unzlib(data, length, inflated))
+		{
+			error = "CSW pulses won't inflate.";
+			return false;
+		}
+		data = inflated.empty() ? NULL : &inflated[0];
+		length = inflated.size();
+	}
+	else if (compression != 1)
+	{
+		error = "Unknown CSW compression.";
+		return false;
+	}
+
+	if (!readcswpulses(data, length, tape))
+	{
+		error = "CSW pulses stop short.";
+		return false;
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,909 @@
+#ifndef __cuts_h
+#define __cuts_h
+
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tapesource.h"
+#include "cswfile.h"
+
+// The tape decoder. Feed it 16 bit samples, get bytes and blocks back.
+//
+// Or pulses, from a CSW. Everything's done in half cycles anyway, so they
+//  go straight in where the samples would have been counted out.
+//
+// Needs shared/defines.h.
+
+
+// Set structure packing to byte boundaries
+//
+#pragma pack(push, 1)
+
+typedef struct
+{
+	// Ordered as received from tape
+	//
+	BYTE flags;
+	BYTE hiBlockNum, loBlockNum;
+	BYTE bytesInBlockMinus1;
+	BYTE hiRunAddress, loRunAddress;
+	BYTE hiBlockLoadAddress, loBlockLoadAddress;
+}
+ATOMTAPEHEADER;
+
+#pragma pack(pop)
+
+
+// One named block as read off the tape.
+//
+struct tapeblock
+{
+	BYTE preamble[4];
+	BYTE name[14];
+	ATOMTAPEHEADER header;
+	BYTE data[256];
+	BYTE sum;
+
+	// Sample offset of the end of the block's leader.
+	//
+	size_t leaderEnd;
+
+	bool isNamed(void) const
+	{
+		return memcmp(preamble, "****", 4) == 0;
+	}
+
+	// Courtesy calculations :)
+	//
+	bool isFirst(void) const
+	{
+		return (header.flags & (1 << 5)) == 0;
+	}
+
+	bool isLast(void) const
+	{
+		return (header.flags & (1 << 7)) == 0;
+	}
+
+	int length(void) const
+	{
+		return header.bytesInBlockMinus1 + 1;
+	}
+
+	int blockNum(void) const
+	{
+		return header.loBlockNum + 256 * header.hiBlockNum;
+	}
+
+	int runAddress(void) const
+	{
+		return header.loRunAddress + 256 * header.hiRunAddress;
+	}
+
+	int loadAddress(void) const
+	{
+		return header.loBlockLoadAddress + 256 * header.hiBlockLoadAddress;
+	}
+};
+
+
+// And no, I didn't miss the obvious comical acronym ;)
+//
+class cuts
+{
+public:
+	cuts(tapesource& tape, int sampleRate) :
+	  m_tape(tape),
+		  m_sampleRate(sampleRate),
+		  m_pulses(tape.pulses())
+	  {
+		  load(0);
+		  m_region = 0;
+
+		  // Standard Atom tape until we're told or find out otherwise.
+		  //
+		  m_autoTone = true;
+		  m_autoCycles = true;
+		  m_minHalf = m_sampleRate / 14000 > 2 ? m_sampleRate / 14000 : 2;
+		  m_maxHalf = m_sampleRate / 3000;
+
+		  // Down at 8khz a half cycle of high tone can be a single sample.
+		  //
+		  if (m_minHalf > m_sampleRate / 4800)
+		  {
+			  m_minHalf = m_sampleRate / 4800 > 1 ? m_sampleRate / 4800 : 1;
+		  }
+		  setTones(2400, 1200);
+		  setCycles(8, 4);
+	  };
+
+	  int m_sampleRate;
+
+	  // The bit model.
+	  //
+	  // A 1 is m_oneCycles cycles of high tone, a 0 is m_zeroCycles cycles of
+	  //  low tone. That's 8 of 2400hz and 4 of 1200hz on a standard 300 baud
+	  //  tape but turbo loaders do as they please.
+	  //
+	  // Cycle lengths are kept in 1/16ths of a sample, turbo tones can be
+	  //  down to a handful of samples per cycle and rounding those to whole
+	  //  samples would throw the thresholds right off.
+	  //
+	  int m_hiCycle16;
+	  int m_loCycle16;
+	  int m_oneCycles;
+	  int m_zeroCycles;
+
+	  // Cycle and half cycle lengths, in samples, at or above which we're
+	  //  looking at low tone.
+	  //
+	  int m_threshold16;
+	  int m_halfThreshold16;
+
+	  // Whether the tones and cycles per bit get measured from the tape.
+	  //
+	  bool m_autoTone;
+	  bool m_autoCycles;
+	  int m_minHalf;
+	  int m_maxHalf;
+
+	  tapesource& m_tape;
+
+	  // The tapehead, and the run of samples the tape gave us that it's in.
+	  //  m_window is the sample at m_base.
+	  //
+	  const short* m_tapehead;
+	  const short* m_window;
+	  const short* m_windowEnd;
+	  size_t m_base;
+
+	  // Spans of the tape, as [start,end) sample offsets, that the pre-scan
+	  //  thinks could hold tone. Empty means look everywhere.
+	  //
+	  std::vector<std::pair<size_t, size_t> > m_regions;
+	  size_t m_region;
+
+	  // For a tape of pulses, the one the tapehead's in and how far into
+	  //  it it is, in samples. The sample pointers go unused.
+	  //
+	  const pulsetape* m_pulses;
+	  size_t m_pulse;
+	  size_t m_into;
+
+
+	  // Sets the high and low tone frequencies.
+	  //
+	  void setTones(int hiHz, int loHz)
+	  {
+		  m_hiCycle16 = (m_sampleRate * 16) / hiHz;
+		  m_loCycle16 = (m_sampleRate * 16) / loHz;
+		  setThresholds();
+	  }
+
+	  void setCycles(int oneCycles, int zeroCycles)
+	  {
+		  m_oneCycles = oneCycles;
+		  m_zeroCycles = zeroCycles;
+	  }
+
+	  // Half way between the high and low tone cycle lengths, kept in 16ths
+	  //  of a sample like them. Counts are scaled up to compare. At 11025hz
+	  //  a high half cycle is 2 or 3 samples and a low one 4 or 5, so whole
+	  //  samples won't do.
+	  //
+	  void setThresholds(void)
+	  {
+		  m_threshold16 = (m_hiCycle16 + m_loCycle16) / 2;
+		  m_halfThreshold16 = (m_hiCycle16 + m_loCycle16) / 4;
+	  }
+
+
+	  // Sample offset of the tapehead.
+	  //
+	  size_t tell(void) const
+	  {
+		  if (m_pulses)
+		  {
+			  return m_pulse < m_pulses->pulseCount() ? m_pulses->m_starts[m_pulse] + m_into : m_pulses->length();
+		  }
+		  return m_base + (m_tapehead - m_window);
+	  }
+
+	  // Moves the tapehead to sample offset 'pos'. Cheap if it's in the
+	  //  samples we've already got.
+	  //
+	  void seek(size_t pos)
+	  {
+		  if (m_pulses)
+		  {
+			  load(pos);
+			  return;
+		  }
+
+		  if (pos >= m_base && pos <= m_base + (m_windowEnd - m_window))
+		  {
+			  m_tapehead = m_window + (pos - m_base);
+			  return;
+		  }
+
+		  load(pos);
+	  }
+
+	  // Asks the tape for samples from 'pos' on. False at the end of the tape.
+	  //
+	  bool load(size_t pos)
+	  {
+		  if (m_pulses)
+		  {
+			  m_pulse = m_pulses->pulseAt(pos);
+			  m_into = m_pulse < m_pulses->pulseCount() ? pos - m_pulses->m_starts[m_pulse] : 0;
+			  return m_pulse < m_pulses->pulseCount();
+		  }
+
+		  const short* samples;
+		  size_t n = m_tape.fetch(pos, samples);
+
+		  m_base = pos;
+		  m_window = m_tapehead = samples;
+		  m_windowEnd = samples + n;
+		  return n != 0;
+	  }
+
+	  bool atEnd(void)
+	  {
+		  if (m_pulses)
+		  {
+			  return m_pulse >= m_pulses->pulseCount();
+		  }
+		  return m_tapehead == m_windowEnd && !load(tell());
+	  }
+
+
+	  // Cheap first pass over the whole tape. Chops it into windows of
+	  //  'window' samples (10ms is good) and measures the energy and the
+	  //  zero crossing rate of each. Silence has no energy, speech and other
+	  //  machines' tapes cross zero at the wrong rate. What's left goes
+	  //  into m_regions for findLeader to look at.
+	  //
+	  // The inner loops are kept branch-free so the compiler can vectorise them.
+	  //
+	  void prescan(int window)
+	  {
+		  m_regions.clear();
+		  m_region = 0;
+
+		  // Pulses have nothing to skip, there are no samples to look at.
+		  //
+		  if (window < 2 || m_pulses)
+		  {
+			  return;
+		  }
+
+		  // Expected crossings per window: two per cycle. Low tone gives half
+		  //  of what high tone does. Allow some slop either side, and if we're
+		  //  working the tones out for ourselves leave room for turbo tones up
+		  //  to 4 times faster.
+		  //
+		  int hiCrossings = (2 * 16 * window) / m_hiCycle16;
+		  int minCrossings = hiCrossings / 3;
+		  int maxCrossings = hiCrossings * (m_autoTone ? 6 : 3) / 2;
+
+		  std::vector<int> energy;
+		  std::vector<int> crossings;
+
+		  // Whole windows only, a part window at the end just goes along
+		  //  with the one before.
+		  //
+		  size_t tapeLength = 0;
+		  long long total = 0;
+		  for (;;)
+		  {
+			  const short* s;
+			  size_t n = m_tape.fetch(energy.size() * window, s, window);
+			  tapeLength = energy.size() * window + n;
+			  if (n < size_t(window))
+			  {
+				  break;
+			  }
+
+			  int e = 0, z = 0;
+			  for (int i = 0; i < window; ++i)
+			  {
+				  int v = s[i];
+				  e += (v ^ (v >> 31)) - (v >> 31);
+			  }
+			  for (int i = 1; i < window; ++i)
+			  {
+				  z += (s[i - 1] < 0) != (s[i] < 0);
+			  }
+			  energy.push_back(e / window);
+			  crossings.push_back(z);
+			  total += e / window;
+		  }
+
+		  seek(0);
+
+		  size_t nWindows = energy.size();
+		  if (nWindows == 0)
+		  {
+			  return;
+		  }
+
+		  // Anything quieter than an eighth of the average level is silence
+		  //  or hiss for our purposes. Real tone sits well above that.
+		  //
+		  int floor = int(total / nWindows) / 8;
+		  if (floor < 64)
+		  {
+			  floor = 64;
+		  }
+
+		  for (size_t w = 0; w < nWindows; ++w)
+		  {
+			  if (energy[w] < floor || crossings[w] < minCrossings || crossings[w] > maxCrossings)
+			  {
+				  continue;
+			  }
+
+			  // Pad each window by a neighbour either side so that the edges
+			  //  of a leader don't get clipped off, and glue touching spans.
+			  //
+			  size_t start = (w > 0 ? w - 1 : 0) * window;
+			  size_t end = (w + 2 < nWindows ? w + 2 : nWindows) * window;
+			  if (w + 2 >= nWindows)
+			  {
+				  end = tapeLength;
+			  }
+
+			  if (!m_regions.empty() && m_regions.back().second >= start)
+			  {
+				  m_regions.back().second = end;
+			  }
+			  else
+			  {
+				  m_regions.push_back(std::make_pair(start, end));
+			  }
+		  }
+	  }
+
+
+	  // Moves the tapehead up to the next pre-scanned region if it isn't in one.
+	  // Returns true if the tapehead moved.
+	  //
+	  bool skipToRegion(void)
+	  {
+		  size_t pos = tell();
+
+		  while (m_region < m_regions.size() && pos >= m_regions[m_region].second)
+		  {
+			  ++m_region;
+		  }
+
+		  if (m_region == m_regions.size())
+		  {
+			  // Nothing more worth looking at, run off the end of the tape.
+			  //
+			  load((size_t)-1);
+			  return true;
+		  }
+
+		  if (pos < m_regions[m_region].first)
+		  {
+			  seek(m_regions[m_region].first);
+			  return true;
+		  }
+
+		  return false;
+	  }
+
+
+	  // Start here.
+	  //
+	  // Finds tone data in the stream. Should probably use some kind of filter,
+	  //  but I'm not that smart. Plus simple is good, right?
+	  //
+	  // Advances tapehead to first sample of new cycle of header tone.
+	  //
+	  // If the tones are automatic the leader's own frequency becomes the
+	  //  high tone from here on in.
+	  //
+	  bool findLeader(void)
+	  {
+		  // Locate leader.
+		  //
+		  // 1024 half cycles is about 200ms of standard leader. Data can't
+		  //  get anywhere near that, a byte of FFs still breaks the high tone
+		  //  for its start bit every 10 bits.
+		  //
+		  // A half cycle shorter than m_minHalf is hiss, not tone, however
+		  //  fast the turbo loader. One longer than m_maxHalf (1500hz) is too
+		  //  low to be a high tone, and is most likely mains hum or music.
+		  //
+		  int cycles = 0;
+		  int sum16 = 0;
+		  while(cycles < 1024)
+		  {
+			  // Don't waste time counting through silence and chatter.
+			  //
+			  if (!m_regions.empty() && skipToRegion())
+			  {
+				  if (atEnd())
+				  {
+					  return false;
+				  }
+				  cycles = 0;
+			  }
+
+			  int count = 0;
+			  if (!countSimilarSamples(count))
+			  {
+				  return false;
+			  }
+
+			  // If the count we see is within 6% (or a sample, there's jitter
+			  //  on every crossing) of the expected value, bump the cycle
+			  //  counter. The expected value is the number of samples that
+			  //  represents half a cycle of high tone. Unless we've been told
+			  //  what that is, it's the average of the run so far.
+			  //
+			  int expected16 = m_hiCycle16 / 2;
+			  if (m_autoTone && cycles)
+			  {
+				  expected16 = sum16 / cycles;
+			  }
+
+			  bool plausible = !m_autoTone || (count >= m_minHalf && count <= m_maxHalf);
+
+			  int diff16 = abs(count * 16 - expected16);
+			  if (plausible && diff16 <= expected16 / 16 + 16)
+			  {
+				  ++cycles;
+				  sum16 += count * 16;
+			  }
+			  else if (plausible)
+			  {
+				  // Could be the start of something else.
+				  //
+				  cycles = 1;
+				  sum16 = count * 16;
+			  }
+			  else
+			  {
+				  cycles = 0;
+				  sum16 = 0;
+			  }
+		  }
+
+		  if (m_autoTone)
+		  {
+			  // Assume the usual octave between the tones until the start bit
+			  //  tells us otherwise.
+			  //
+			  m_hiCycle16 = (sum16 * 2) / cycles;
+			  m_loCycle16 = m_hiCycle16 * 2;
+			  setThresholds();
+		  }
+
+		  // Now go on to find start bit! Fly little one! Be free!
+
+		  return true;
+	  }
+
+
+	  // Counts the number of similarly-signed samples at the tapehead onward.
+	  // Assumes tapehead is at 1st sample with a sign different to that of its
+	  //  predecessor.
+	  // Advances tapehead to 1st sample with new sign.
+	  //
+	  bool countSimilarSamples(int& count)
+	  {
+		  count = 0;
+
+		  if (atEnd())
+		  {
+			  return false;
+		  }
+
+		  // A pulse is a half cycle. Like a run of samples, one that runs
+		  //  off the end of the tape doesn't count.
+		  //
+		  if (m_pulses)
+		  {
+			  count = int(m_pulses->m_pulses[m_pulse] - m_into);
+			  m_into = 0;
+			  return ++m_pulse < m_pulses->pulseCount();
+		  }
+
+		  // The half cycle can run on past the samples we've got, so
+		  //  count what's here and go back for more as needed.
+		  //
+		  bool neg = *m_tapehead < 0;
+		  for (;;)
+		  {
+			  const short* p = m_tapehead;
+			  while (p != m_windowEnd && (*p < 0) == neg)
+			  {
+				  ++p;
+			  }
+			  count += int(p - m_tapehead);
+			  m_tapehead = p;
+
+			  if (p != m_windowEnd)
+			  {
+				  return true;
+			  }
+			  if (!load(tell()))
+			  {
+				  return false;
+			  }
+		  }
+	  }
+
+
+	  // Counts the number of samples forming one cycle.
+	  // Assumes tapehead is at 1st sample of a new cycle.
+	  // Advances tapehead to 1st sample of next cycle.
+	  //
+	  bool getCycleCount(int& count)
+	  {
+		  int loper, hiper;
+		  if (!countSimilarSamples(loper))
+		  {
+			  return false;
+		  }
+		  if (!countSimilarSamples(hiper))
+		  {
+			  return false;
+		  }
+
+		  count = loper + hiper;
+		  return true;
+	  }
+
+
+	  // Locates a start bit in the bitstream.
+	  // Assumes tapehead is at first sample of a high cycle.
+	  // Advances tapehead to the first sample of a startbit.
+	  //
+	  bool findStartBit(void)
+	  {
+		  int count;
+		  size_t cursor;
+
+		  // Look for a cycle with a period greater than the average 
+		  // samples per cycle of high tone.
+		  //
+		  // |-- hi cycle --|
+		  // |------||------|
+		  // |  lo  ||  hi  |
+		  //
+		  // at low tone we have
+		  // |      lo      ||      hi      |
+		  //                   ^
+		  //                   m_threshold16, half way between the two
+		  //
+		  // So you can see that any sample count > m_threshold16
+		  // must be a low tone = 0 bit.
+		  //
+		  // Do the test on half cycles though, at m_halfThreshold16. Whole cycles
+		  // only line up with the bits if we happened to start counting on
+		  // the right polarity, and after a pre-scan skip that's a coin toss.
+		  //
+		  do
+		  {
+			  cursor = tell();
+
+			  if (!countSimilarSamples(count))
+			  {
+				  return false;
+			  }
+		  }
+		  while (count * 16 < m_halfThreshold16);
+
+		  seek(cursor);
+		  return true;
+	  }
+
+
+	  // Works out the bit model from the first few bytes after a leader.
+	  // Assumes tapehead is at the first sample of a start bit, and leaves
+	  //  it there.
+	  //
+	  // The start bit gives us the low tone. Then the shortest run of low
+	  //  tone cycles in the next few bytes is one 0 bit and the shortest run
+	  //  of high tone is one 1 bit. There's bound to be a lone 0 and a lone 1
+	  //  in there somewhere, the start bit followed by a set bit 0 will do.
+	  //
+	  void calibrate(void)
+	  {
+		  if (!m_autoTone && !m_autoCycles)
+		  {
+			  return;
+		  }
+
+		  size_t cursor = tell();
+
+		  int count;
+		  if (m_autoTone && getCycleCount(count))
+		  {
+			  m_loCycle16 = count * 16;
+			  setThresholds();
+		  }
+		  seek(cursor);
+
+		  int loRuns = 0, hiRuns = 0;
+		  int minLoRun = 0x7fffffff, minHiRun = 0x7fffffff;
+		  int loSum = 0, loCycles = 0, hiSum = 0, hiCycles = 0;
+
+		  bool lo = true;
+		  int run = 0;
+		  while (loRuns + hiRuns < 64 && getCycleCount(count))
+		  {
+			  bool isLo = count * 16 >= m_threshold16;
+			  if (isLo != lo)
+			  {
+				  if (lo)
+				  {
+					  minLoRun = run < minLoRun ? run : minLoRun;
+					  ++loRuns;
+				  }
+				  else
+				  {
+					  minHiRun = run < minHiRun ? run : minHiRun;
+					  ++hiRuns;
+				  }
+				  lo = isLo;
+				  run = 0;
+			  }
+
+			  // A long stretch of high tone is a gap or the next leader.
+			  //
+			  if (!lo && run > 64)
+			  {
+				  break;
+			  }
+
+			  ++run;
+			  if (isLo)
+			  {
+				  loSum += count;
+				  ++loCycles;
+			  }
+			  else
+			  {
+				  hiSum += count;
+				  ++hiCycles;
+			  }
+		  }
+
+		  seek(cursor);
+
+		  if (m_autoTone && loCycles && hiCycles)
+		  {
+			  m_loCycle16 = (loSum * 16) / loCycles;
+			  m_hiCycle16 = (hiSum * 16) / hiCycles;
+			  setThresholds();
+		  }
+
+		  if (m_autoCycles && loRuns && hiRuns)
+		  {
+			  // Bits should all take the same time. If the counts don't agree
+			  //  on that then trust the 0s, they start every byte.
+			  //
+			  int loTime = minLoRun * m_loCycle16;
+			  int hiTime = minHiRun * m_hiCycle16;
+			  if (abs(loTime - hiTime) > loTime / 4)
+			  {
+				  minHiRun = (loTime + m_hiCycle16 / 2) / m_hiCycle16;
+			  }
+			  setCycles(minHiRun, minLoRun);
+		  }
+	  }
+
+
+	  // Gets a bit. 0 or 1 dude.
+	  // Assumes tapehead is at first sample of new bit.
+	  // Advances tapehead to start of next bit.
+	  //
+	  bool getBit(bool& bit)
+	  {
+		  int count;
+		  if (!getCycleCount(count))
+		  {
+			  return false;
+		  }
+
+		  // Reject the bit if we see a tone out of sequence.
+		  //
+		  if (count * 16 < m_threshold16)
+		  {
+			  // 8 cycles of 24khz. One down, 7 left in town.
+			  //
+			  // The last cycle only has to be there. If digital silence
+			  //  follows, as between programs on a compilation, its second
+			  //  half runs on into it.
+			  //
+			  bit = 1;
+			  for (int i = 1; i < m_oneCycles; ++i)
+			  {
+				  getCycleCount(count);
+				  if (count * 16 > m_threshold16 && i != m_oneCycles - 1)
+				  {
+					  return false;
+				  }
+			  }
+		  }
+		  else
+		  {
+			  // 4 cycles of 12khz. One's been seen, we need three.
+			  //
+			  bit = 0;
+			  for (int i = 1; i < m_zeroCycles; ++i)
+			  {
+				  getCycleCount(count);
+				  if (count * 16 < m_threshold16)
+				  {
+					  return false;
+				  }
+			  }
+		  }
+
+		  return true;
+	  }
+
+
+	  // This should be pretty obvious.
+	  // Assumes tapehead is at first sample of new tone.
+	  // Advances tapehead to first sample after stop bit.
+	  //
+	  bool getByte(BYTE& byte)
+	  {
+		  // The tapehead can be at the start of a cycle of leader tone.
+		  // This leader may be as short as one cycle!
+		  // This is evident in fred.wav (recorded from a real Atom) which
+		  // exhibits the curious phenomena of having 9 cycles of high tone
+		  // in its stop bits. Treating this like a micro-leader allows the
+		  // handling of leader to be generic.
+		  //
+		  if (!findStartBit())
+		  {
+			  return false;
+		  }
+
+		  bool bit;
+		  if (!getBit(bit) || bit)
+		  {
+			  return false;
+		  }
+
+		  byte = 0;
+		  for (int i = 0; i < 8; ++i)
+		  {
+			  if (!getBit(bit))
+			  {
+				  return false;
+			  }
+			  if (bit)
+			  {
+				  byte |= 1 << i;
+			  }
+		  }
+
+		  if (!getBit(bit) || !bit)
+		  {
+			  return false;
+		  }
+
+		  m_check += byte;
+
+		  return true;
+	  }
+
+	  BYTE m_check;
+
+
+	  // Reads a whole named block, leader to checksum.
+	  // Returns false with a reason in 'error' if it can't. If the block's
+	  //  first 4 bytes came off the tape fine but weren't a '****' preamble,
+	  //  error is NULL and they're left in block.preamble. That's what an
+	  //  unnamed file looks like.
+	  //
+	  bool readBlock(tapeblock& block, const char*& error)
+	  {
+		  memset(&block, 0, sizeof(block));
+
+		  if (!findLeader())
+		  {
+			  error = "Didn't find leader tone.";
+			  return false;
+		  }
+
+		  block.leaderEnd = tell();
+
+		  if (!findStartBit())
+		  {
+			  error = "Didn't find start bit.";
+			  return false;
+		  }
+
+		  calibrate();
+
+		  int i;
+		  m_check = 0;
+
+		  // Read header preamble: '****'
+		  //
+		  for (i = 0; i < 4; ++i)
+		  {
+			  if (!getByte(block.preamble[i]))
+			  {
+				  error = "Failed reading preamble.";
+				  return false;
+			  }
+		  }
+
+		  if (!block.isNamed())
+		  {
+			  error = NULL;
+			  return false;
+		  }
+
+		  // Now get the filename up to and includeing the 0x0d terminator.
+		  // Max size is 13 chars + terminator = 14.
+		  //
+		  i = -1;
+		  do
+		  {
+			  if (!getByte(block.name[++i]))
+			  {
+				  error = "Failed reading filename.";
+				  return false;
+			  }
+		  }
+		  while(block.name[i] != 0x0d && i != 13);
+		  block.name[i] = 0x0;
+
+		  // Read header
+		  //
+		  BYTE* headBytes = (BYTE*)&block.header;
+		  for (i = 0; i < 8; ++i)
+		  {
+			  if (!getByte(headBytes[i]))
+			  {
+				  error = "Failed reading header.";
+				  return false;
+			  }
+		  }
+
+		  // Read data block
+		  //
+		  for (i = 0; i < block.length(); ++i)
+		  {
+			  if (!getByte(block.data[i]))
+			  {
+				  error = "Failed reading data block.";
+				  return false;
+			  }
+		  }
+
+		  // Check some checksum
+		  //
+		  BYTE expected = m_check;
+		  if (!getByte(block.sum))
+		  {
+			  error = "Failed reading checksum byte.";
+			  return false;
+		  }
+
+		  if (block.sum != expected)
+		  {
+			  error = "SUM";
+			  return false;
+		  }
+
+		  return true;
+	  }
+};
+
+#endif
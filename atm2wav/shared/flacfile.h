@@ -0,0 +1,770 @@
+#ifndef __flacfile_h
+#define __flacfile_h
+
+#include <istream>
+#include <vector>
+#include <string.h>
+
+#include "tapesource.h"
+
+// FLAC, read straight into the decoder with no WAV in between. Enough of
+//  it for tape transfers: constant, verbatim, fixed and LPC subframes,
+//  Rice coded residuals, 8 to 24 bits and any channel layout. Only the
+//  first channel is kept, as 16 bit samples, whatever the depth.
+//
+// Checksums, frame CRCs and the MD5, go unchecked. A bad frame won't
+//  decode anyway, and the tape decoder has checksums of its own.
+//
+// Needs shared/defines.h.
+
+
+// FLAC's bits go in msb first. Reads the stream a buffer at a time and
+//  keeps up to 64 bits of it on hand. Reading past the end gives 0s and
+//  sets m_overrun.
+//
+class flacbits
+{
+public:
+	flacbits(std::istream& in) :
+		m_in(in),
+		m_buffer(BUFFERBYTES)
+	{
+		reset();
+	}
+
+	void reset(void)
+	{
+		m_pos = 0;
+		m_end = 0;
+		m_cache = 0;
+		m_count = 0;
+		m_overrun = false;
+	}
+
+	DWORD bits(int count)
+	{
+		if (count == 0)
+		{
+			return 0;
+		}
+
+		if (m_count < count)
+		{
+			refill();
+			if (m_count < count)
+			{
+				m_overrun = true;
+				m_count = count;
+			}
+		}
+
+		DWORD value = (DWORD)(m_cache >> (64 - count));
+		m_cache <<= count;
+		m_count -= count;
+		return value;
+	}
+
+	int signedBits(int count)
+	{
+		if (count == 0)
+		{
+			return 0;
+		}
+		DWORD value = bits(count);
+		return count < 32 && (value >> (count - 1)) ? int(value) - (1 << count) : int(value);
+	}
+
+	// The number of 0s before the next 1, which is used up too.
+	//
+	DWORD unary(void)
+	{
+		DWORD zeros = 0;
+		for (;;)
+		{
+			if (m_count == 0)
+			{
+				refill();
+				if (m_count == 0)
+				{
+					m_overrun = true;
+					return zeros;
+				}
+			}
+
+			if (m_cache == 0)
+			{
+				zeros += m_count;
+				m_count = 0;
+				continue;
+			}
+
+			while (!(m_cache >> 63))
+			{
+				m_cache <<= 1;
+				--m_count;
+				++zeros;
+			}
+			m_cache <<= 1;
+			--m_count;
+			return zeros;
+		}
+	}
+
+	void alignByte(void)
+	{
+		bits(m_count & 7);
+	}
+
+	// Nothing left at all, not even a part byte.
+	//
+	bool atEnd(void)
+	{
+		if (m_count == 0)
+		{
+			refill();
+		}
+		return m_count == 0;
+	}
+
+	bool m_overrun;
+
+private:
+	void refill(void)
+	{
+		while (m_count <= 56)
+		{
+			if (m_pos == m_end)
+			{
+				m_in.read((char*)&m_buffer[0], (std::streamsize)m_buffer.size());
+				m_pos = 0;
+				m_end = size_t(m_in.gcount());
+				if (m_end == 0)
+				{
+					return;
+				}
+			}
+			m_cache |= (unsigned long long)m_buffer[m_pos++] << (56 - m_count);
+			m_count += 8;
+		}
+	}
+
+	static const size_t BUFFERBYTES = 1 << 16;
+
+	std::istream& m_in;
+	std::vector<BYTE> m_buffer;
+	size_t m_pos;
+	size_t m_end;
+	unsigned long long m_cache;
+	int m_count;
+};
+
+
+// The decoder proper, a frame at a time.
+//
+class flacstream
+{
+public:
+	flacstream(std::istream& in) :
+		m_sampleRate(0),
+		m_channels(0),
+		m_bitsPerSample(0),
+		m_totalSamples(0),
+		m_in(in),
+		m_bits(in)
+	{
+	}
+
+	// Reads the signature and the metadata, leaving the stream at the
+	//  first frame.
+	// Returns false with a reason in 'error' if the file's no good to us.
+	//
+	bool open(const char*& error)
+	{
+		BYTE header[4];
+		m_in.read((char*)header, 4);
+		if (!m_in || memcmp(header, "fLaC", 4) != 0)
+		{
+			error = "Not a FLAC file.";
+			return false;
+		}
+
+		// Blocks of metadata, only STREAMINFO (0) matters. It comes first.
+		//
+		bool last;
+		do
+		{
+			m_in.read((char*)header, 4);
+			if (!m_in)
+			{
+				error = "FLAC metadata stops short.";
+				return false;
+			}
+			last = (header[0] & 0x80) != 0;
+			size_t length = (header[1] << 16) | (header[2] << 8) | header[3];
+
+			if ((header[0] & 0x7f) == 0 && length >= 34)
+			{
+				BYTE info[34];
+				m_in.read((char*)info, 34);
+				m_sampleRate = (info[10] << 12) | (info[11] << 4) | (info[12] >> 4);
+				m_channels = ((info[12] >> 1) & 7) + 1;
+				m_bitsPerSample = (((info[12] & 1) << 4) | (info[13] >> 4)) + 1;
+				m_totalSamples = ((unsigned long long)(info[13] & 15) << 32) | ((DWORD)info[14] << 24) | (info[15] << 16) | (info[16] << 8) | info[17];
+				length -= 34;
+			}
+			m_in.seekg(length, std::ios_base::cur);
+		}
+		while (!last && m_in);
+
+		if (!m_in || m_sampleRate == 0)
+		{
+			error = "No FLAC stream info.";
+			return false;
+		}
+
+		if (m_bitsPerSample < 4 || m_bitsPerSample > 24)
+		{
+			error = "FLAC should be 24 bit or less please.";
+			return false;
+		}
+
+		m_firstFrame = m_in.tellg();
+		m_bits.reset();
+		return true;
+	}
+
+	// Back to the first frame.
+	//
+	void rewind(void)
+	{
+		m_in.clear();
+		m_in.seekg(m_firstFrame);
+		m_bits.reset();
+	}
+
+	// Decodes the next frame onto the end of 'samples'.
+	// Returns false at the end of the stream, with error NULL, or with a
+	//  reason if the frame's bad.
+	//
+	bool frame(std::vector<short>& samples, const char*& error)
+	{
+		error = NULL;
+		if (m_bits.atEnd())
+		{
+			return false;
+		}
+
+		if (m_bits.bits(14) != 0x3ffe)
+		{
+			error = "Lost FLAC frame sync.";
+			return false;
+		}
+		m_bits.bits(2);
+
+		int blockSizeCode = m_bits.bits(4);
+		int rateCode = m_bits.bits(4);
+		int channelCode = m_bits.bits(4);
+		int sizeCode = m_bits.bits(3);
+		m_bits.bits(1);
+
+		// Frame or sample number, UTF-8 style. Not needed, frames come in
+		//  order.
+		//
+		DWORD first = m_bits.bits(8);
+		for (DWORD mask = 0x40; (first & 0x80) && (first & mask); mask >>= 1)
+		{
+			m_bits.bits(8);
+		}
+
+		int blockSize;
+		if (blockSizeCode == 1)
+		{
+			blockSize = 192;
+		}
+		else if (blockSizeCode >= 2 && blockSizeCode <= 5)
+		{
+			blockSize = 576 << (blockSizeCode - 2);
+		}
+		else if (blockSizeCode == 6)
+		{
+			blockSize = m_bits.bits(8) + 1;
+		}
+		else if (blockSizeCode == 7)
+		{
+			blockSize = m_bits.bits(16) + 1;
+		}
+		else if (blockSizeCode >= 8)
+		{
+			blockSize = 256 << (blockSizeCode - 8);
+		}
+		else
+		{
+			error = "Bad FLAC block size.";
+			return false;
+		}
+
+		if (rateCode == 12)
+		{
+			m_bits.bits(8);
+		}
+		else if (rateCode == 13 || rateCode == 14)
+		{
+			m_bits.bits(16);
+		}
+
+		static const int SAMPLESIZES[8] = { 0, 8, 12, 0, 16, 20, 24, 0 };
+		int bitsPerSample = sizeCode ? SAMPLESIZES[sizeCode] : m_bitsPerSample;
+		if (bitsPerSample == 0 || bitsPerSample > 24 || channelCode > 10)
+		{
+			error = "Unsupported FLAC frame.";
+			return false;
+		}
+
+		// Header CRC.
+		//
+		m_bits.bits(8);
+
+		int channels = channelCode < 8 ? channelCode + 1 : 2;
+		if ((int)m_channel.size() < channels)
+		{
+			m_channel.resize(channels);
+		}
+
+		// The side channel of a stereo pair is a bit wider.
+		//
+		for (int c = 0; c < channels; ++c)
+		{
+			bool side = (channelCode == 8 && c == 1) || (channelCode == 9 && c == 0) || (channelCode == 10 && c == 1);
+			if (!subframe(m_channel[c], blockSize, bitsPerSample + (side ? 1 : 0), error))
+			{
+				return false;
+			}
+		}
+
+		m_bits.alignByte();
+		m_bits.bits(16);
+
+		if (m_bits.m_overrun)
+		{
+			error = "FLAC frame stops short.";
+			return false;
+		}
+
+		// Put the left channel back together if it's not as it is, then
+		//  down (or up) to 16 bits.
+		//
+		std::vector<int>& left = m_channel[0];
+		const std::vector<int>& other = m_channel[channels - 1];
+		if (channelCode == 9)
+		{
+			for (int i = 0; i < blockSize; ++i)
+			{
+				left[i] += other[i];
+			}
+		}
+		else if (channelCode == 10)
+		{
+			for (int i = 0; i < blockSize; ++i)
+			{
+				left[i] = (((left[i] << 1) | (other[i] & 1)) + other[i]) >> 1;
+			}
+		}
+
+		size_t start = samples.size();
+		samples.resize(start + blockSize);
+		int shift = bitsPerSample - 16;
+		for (int i = 0; i < blockSize; ++i)
+		{
+			samples[start + i] = (short)(shift >= 0 ? left[i] >> shift : left[i] << -shift);
+		}
+		return true;
+	}
+
+	int m_sampleRate;
+	int m_channels;
+	int m_bitsPerSample;
+
+	// 0 if the encoder didn't know.
+	//
+	unsigned long long m_totalSamples;
+
+private:
+	bool subframe(std::vector<int>& out, int blockSize, int bitsPerSample, const char*& error)
+	{
+		out.resize(blockSize);
+
+		m_bits.bits(1);
+		int type = m_bits.bits(6);
+
+		// Wasted bits, the low bits that were 0 all through the block.
+		//
+		int wasted = 0;
+		if (m_bits.bits(1))
+		{
+			wasted = m_bits.unary() + 1;
+			bitsPerSample -= wasted;
+		}
+
+		if (type == 0)
+		{
+			int value = m_bits.signedBits(bitsPerSample);
+			for (int i = 0; i < blockSize; ++i)
+			{
+				out[i] = value;
+			}
+		}
+		else if (type == 1)
+		{
+			for (int i = 0; i < blockSize; ++i)
+			{
+				out[i] = m_bits.signedBits(bitsPerSample);
+			}
+		}
+		else if (type >= 8 && type <= 12)
+		{
+			int order = type - 8;
+			if (order > blockSize)
+			{
+				error = "Bad FLAC predictor order.";
+				return false;
+			}
+
+			for (int i = 0; i < order; ++i)
+			{
+				out[i] = m_bits.signedBits(bitsPerSample);
+			}
+
+			if (!residual(out, blockSize, order, error))
+			{
+				return false;
+			}
+			fixed(out, blockSize, order);
+		}
+		else if (type >= 32)
+		{
+			int order = type - 31;
+			if (order > blockSize)
+			{
+				error = "Bad FLAC predictor order.";
+				return false;
+			}
+
+			for (int i = 0; i < order; ++i)
+			{
+				out[i] = m_bits.signedBits(bitsPerSample);
+			}
+
+			int precision = m_bits.bits(4) + 1;
+			int shift = m_bits.signedBits(5);
+			if (precision == 16 || shift < 0)
+			{
+				error = "Bad FLAC LPC coefficients.";
+				return false;
+			}
+
+			int coefs[32];
+			for (int i = 0; i < order; ++i)
+			{
+				coefs[i] = m_bits.signedBits(precision);
+			}
+
+			if (!residual(out, blockSize, order, error))
+			{
+				return false;
+			}
+			lpc(out, blockSize, order, coefs, shift);
+		}
+		else
+		{
+			error = "Unsupported FLAC subframe.";
+			return false;
+		}
+
+		if (wasted)
+		{
+			for (int i = 0; i < blockSize; ++i)
+			{
+				out[i] <<= wasted;
+			}
+		}
+		return true;
+	}
+
+	// Rice coded residuals, in 2^order partitions, each with its own
+	//  parameter or an escape to plain binary. They go in after the
+	//  warm-up samples for the predictor to add to.
+	//
+	bool residual(std::vector<int>& out, int blockSize, int order, const char*& error)
+	{
+		int method = m_bits.bits(2);
+		if (method > 1)
+		{
+			error = "Unsupported FLAC residual.";
+			return false;
+		}
+
+		int paramBits = method ? 5 : 4;
+		int escape = (1 << paramBits) - 1;
+		int partitionOrder = m_bits.bits(4);
+		int partitionSize = blockSize >> partitionOrder;
+		if ((partitionSize << partitionOrder) != blockSize || partitionSize < order)
+		{
+			error = "Bad FLAC residual partitions.";
+			return false;
+		}
+
+		int i = order;
+		for (int p = 0; p < (1 << partitionOrder); ++p)
+		{
+			int end = (p + 1) * partitionSize;
+			int param = m_bits.bits(paramBits);
+			if (param == escape)
+			{
+				int rawBits = m_bits.bits(5);
+				for (; i < end; ++i)
+				{
+					out[i] = m_bits.signedBits(rawBits);
+				}
+			}
+			else
+			{
+				for (; i < end; ++i)
+				{
+					DWORD value = (m_bits.unary() << param) | m_bits.bits(param);
+					out[i] = int(value >> 1) ^ -int(value & 1);
+				}
+			}
+		}
+		return true;
+	}
+
+	static void fixed(std::vector<int>& out, int blockSize, int order)
+	{
+		int* s = &out[0];
+		switch (order)
+		{
+		case 1:
+			for (int i = 1; i < blockSize; ++i)
+			{
+				s[i] += s[i - 1];
+			}
+			break;
+
+		case 2:
+			for (int i = 2; i < blockSize; ++i)
+			{
+				s[i] += 2 * s[i - 1] - s[i - 2];
+			}
+			break;
+
+		case 3:
+			for (int i = 3; i < blockSize; ++i)
+			{
+				s[i] += 3 * s[i - 1] - 3 * s[i - 2] + s[i - 3];
+			}
+			break;
+
+		case 4:
+			for (int i = 4; i < blockSize; ++i)
+			{
+				s[i] += 4 * s[i - 1] - 6 * s[i - 2] + 4 * s[i - 3] - s[i - 4];
+			}
+			break;
+		}
+	}
+
+	static void lpc(std::vector<int>& out, int blockSize, int order, const int* coefs, int shift)
+	{
+		int* s = &out[0];
+		for (int i = order; i < blockSize; ++i)
+		{
+			long long sum = 0;
+			for (int j = 0; j < order; ++j)
+			{
+				sum += (long long)coefs[j] * s[i - j - 1];
+			}
+			s[i] += int(sum >> shift);
+		}
+	}
+
+	std::istream& m_in;
+	flacbits m_bits;
+	std::streampos m_firstFrame;
+	std::vector<std::vector<int> > m_channel;
+};
+
+
+// Reads a FLAC into memory, as readwav does a WAV.
+//
+inline bool readflac(std::istream& in, std::vector<short>& samples, int& sampleRate, const char*& error)
+{
+	flacstream flac(in);
+	if (!flac.open(error))
+	{
+		return false;
+	}
+
+	sampleRate = flac.m_sampleRate;
+	samples.clear();
+	samples.reserve(size_t(flac.m_totalSamples));
+	while (flac.frame(samples, error))
+	{
+	}
+	return error == NULL;
+}
+
+
+// A FLAC decoded a frame at a time as the decoder wants it, as wavtape
+//  reads a WAV. The same way back is kept on hand, going further back
+//  than that starts decoding over from the first frame.
+//
+class flactape : public tapesource
+{
+public:
+	flactape(std::istream& in) :
+		m_error(NULL),
+		m_flac(in),
+		m_used(0),
+		m_ended(false),
+		m_base(0),
+		m_count(0),
+		m_buffer(BUFFERSAMPLES)
+	{
+	}
+
+	bool open(int& sampleRate, const char*& error)
+	{
+		if (!m_flac.open(error))
+		{
+			return false;
+		}
+		sampleRate = m_flac.m_sampleRate;
+		return true;
+	}
+
+	virtual size_t fetch(size_t pos, const short*& samples, size_t want = 1)
+	{
+		samples = NULL;
+
+		size_t avail = available(pos);
+		if (avail < want && !(m_ended && pos >= m_base))
+		{
+			fill(pos, want);
+			avail = available(pos);
+		}
+
+		if (avail)
+		{
+			samples = &m_buffer[pos - m_base];
+		}
+		return avail;
+	}
+
+	// Set if the tape ended early on a bad frame. Whatever failed to read
+	//  after that failed because of it.
+	//
+	const char* m_error;
+
+private:
+	size_t available(size_t pos) const
+	{
+		return pos >= m_base && pos < m_base + m_count ? m_base + m_count - pos : 0;
+	}
+
+	// Next frame into m_frame. False once there are no more, or on a bad
+	//  frame, which is as far as the tape goes then.
+	//
+	bool decode(void)
+	{
+		m_frame.clear();
+		m_used = 0;
+
+		const char* error;
+		if (!m_flac.frame(m_frame, error))
+		{
+			m_ended = true;
+			if (error)
+			{
+				m_error = error;
+			}
+			return false;
+		}
+		return true;
+	}
+
+	// Decodes until there's 'want' from 'pos' on, or the buffer's full,
+	//  or the tape's over. Keeps a way back from 'pos' and drops
+	//  anything before that.
+	//
+	void fill(size_t pos, size_t want)
+	{
+		size_t keepFrom = pos > KEEPSAMPLES ? pos - KEEPSAMPLES : 0;
+
+		if (pos < m_base)
+		{
+			m_flac.rewind();
+			m_frame.clear();
+			m_used = 0;
+			m_ended = false;
+			m_base = 0;
+			m_count = 0;
+		}
+
+		if (keepFrom >= m_base + m_count)
+		{
+			m_base += m_count;
+			m_count = 0;
+		}
+		else if (keepFrom > m_base)
+		{
+			m_count -= keepFrom - m_base;
+			memmove(&m_buffer[0], &m_buffer[keepFrom - m_base], m_count * sizeof(short));
+			m_base = keepFrom;
+		}
+
+		while (available(pos) < want && m_count < m_buffer.size())
+		{
+			if (m_used == m_frame.size() && !decode())
+			{
+				break;
+			}
+
+			size_t n = m_frame.size() - m_used;
+			if (m_base < keepFrom)
+			{
+				// Nothing wanted from these.
+				//
+				if (n > keepFrom - m_base)
+				{
+					n = keepFrom - m_base;
+				}
+				m_base += n;
+			}
+			else
+			{
+				if (n > m_buffer.size() - m_count)
+				{
+					n = m_buffer.size() - m_count;
+				}
+				memcpy(&m_buffer[m_count], &m_frame[m_used], n * sizeof(short));
+				m_count += n;
+			}
+			m_used += n;
+		}
+	}
+
+	static const size_t BUFFERSAMPLES = 1 << 20;
+	static const size_t KEEPSAMPLES = 1 << 18;
+
+	flacstream m_flac;
+
+	std::vector<short> m_frame;
+	size_t m_used;
+	bool m_ended;
+
+	size_t m_base;
+	size_t m_count;
+	std::vector<short> m_buffer;
+};
+
+#endif
@@ -0,0 +1,1621 @@
+#ifndef __freqout_h
+#define __freqout_h
+
+#include <ostream>
+#include <vector>
+#include <string>
+#include <string.h>
+#include <utility>
+
+#include "gzip.h"
+#include "tapesource.h"
+#include "turboloader.h"
+
+
+// The tape encoder. Give it bytes and blocks, get a WAV back.
+//
+// Needs shared/defines.h and shared/atmheader.h.
+//
+// Also makes CSW and UEF tape images, which come out of the same block
+// structure, and turbo tapes, see writeTurbo.
+
+
+// Sample formats. Each gives the bytes of a high or low sample, half of
+// full scale either way, and knows what silence looks like. The encoder
+// is a template on them, freqoutT, so there's no asking which format per
+// sample or per bit.
+//
+// 32 bits is IEEE float, there's no call for 32 bit integer.
+//
+struct pcm8
+{
+	static const int BYTES = 1;
+	static const int TAG = 1;
+
+	static constexpr char byte(bool high, int)
+	{
+		return high ? (char)0xc0 : (char)0x40;
+	}
+
+	static short decode(const char* in)
+	{
+		return (short)(((BYTE)in[0] - 128) << 8);
+	}
+
+	static constexpr char silence(void)
+	{
+		return (char)0x80;
+	}
+};
+
+struct pcm16
+{
+	static const int BYTES = 2;
+	static const int TAG = 1;
+
+	// +/-16384, little endian.
+	//
+	static constexpr char byte(bool high, int n)
+	{
+		return n == 1 ? (high ? (char)0x40 : (char)0xc0) : 0;
+	}
+
+	static short decode(const char* in)
+	{
+		return (short)(((BYTE)in[1] << 8) | (BYTE)in[0]);
+	}
+
+	static constexpr char silence(void)
+	{
+		return 0;
+	}
+};
+
+struct pcm24
+{
+	static const int BYTES = 3;
+	static const int TAG = 1;
+
+	static constexpr char byte(bool high, int n)
+	{
+		return n == 2 ? (high ? (char)0x40 : (char)0xc0) : 0;
+	}
+
+	static short decode(const char* in)
+	{
+		return (short)(((BYTE)in[2] << 8) | (BYTE)in[1]);
+	}
+
+	static constexpr char silence(void)
+	{
+		return 0;
+	}
+};
+
+struct float32
+{
+	static const int BYTES = 4;
+	static const int TAG = 3;
+
+	// +/-0.5f, 0x3f000000 and 0xbf000000.
+	//
+	static constexpr char byte(bool high, int n)
+	{
+		return n == 3 ? (high ? (char)0x3f : (char)0xbf) : 0;
+	}
+
+	static short decode(const char* in)
+	{
+		float value;
+		memcpy(&value, in, 4);
+		return value >= 1.0f ? 32767 : value <= -1.0f ? -32768 : (short)(value * 32768.0f);
+	}
+
+	static constexpr char silence(void)
+	{
+		return 0;
+	}
+};
+
+
+// Level of sample 'phase' (see freqoutT::synthBit) through a bit of
+// 'cycles' cycles at 'rate'.
+//
+constexpr bool toneIsHigh(int cycles, int phase, int rate)
+{
+	return ((cycles * phase) % rate) * 2 >= rate;
+}
+
+
+// A whole bit of 'cycles' cycles, in 'format', made by the compiler. At a
+// multiple of the baud rate every bit is the same rate/baud samples and
+// starts at phase 0, so sample n is at phase n * baud.
+//
+template <class format, int rate, int baud, int cycles, class bytes = std::make_integer_sequence<int, rate / baud * format::BYTES> >
+struct bitshape;
+
+template <class format, int rate, int baud, int cycles, int... n>
+struct bitshape<format, rate, baud, cycles, std::integer_sequence<int, n...> >
+{
+	static const int SAMPLES = rate / baud;
+	static constexpr char data[sizeof...(n)] = { format::byte(toneIsHigh(cycles, n / format::BYTES * baud, rate), n % format::BYTES)... };
+};
+
+template <class format, int rate, int baud, int cycles, int... n>
+constexpr char bitshape<format, rate, baud, cycles, std::integer_sequence<int, n...> >::data[sizeof...(n)];
+
+// At 44.1khz a 0 is high on samples 19-36, 56-73, 92-110 and 129-146 of
+// its 147, as the old table had it. Checked here, at compile time.
+//
+static_assert(bitshape<pcm8, 44100, 300, 4>::SAMPLES == 147, "0 bit length");
+static_assert(bitshape<pcm8, 44100, 300, 4>::data[18] == 0x40 && bitshape<pcm8, 44100, 300, 4>::data[19] == (char)0xc0, "0 bit shape");
+static_assert(bitshape<pcm8, 44100, 300, 4>::data[128] == 0x40 && bitshape<pcm8, 44100, 300, 4>::data[146] == (char)0xc0, "0 bit shape");
+static_assert(bitshape<pcm8, 44100, 300, 8>::data[0] == 0x40 && bitshape<pcm8, 44100, 300, 8>::data[10] == (char)0xc0, "1 bit shape");
+
+
+// How much high tone goes where, in ms. 'lead' is the leader on the
+// first block, 'leader' the leader on the rest, 'gap' the tone between
+// each block's header and its data.
+//
+// The ROM syncs on every start bit so any amount of tone will do as far
+// as the bytes are concerned. The tone's there to get the tape up to
+// speed and to cover the ROM's own work: after a header it checks the
+// name and prints it before it looks for data. Minimum keeps just a
+// margin over that.
+//
+struct tapetiming
+{
+	tapetiming(int lead, int leader, int gap) :
+		lead(lead),
+		leader(leader),
+		gap(gap)
+	{
+	}
+
+	int lead;
+	int leader;
+	int gap;
+};
+
+static const tapetiming TIMING_STANDARD(4550, 1000, 1000);
+static const tapetiming TIMING_SHORT(2500, 500, 500);
+static const tapetiming TIMING_MINIMUM(1000, 250, 250);
+
+
+// The tape as a whole: its layout, the WAV header round it and the
+// buffering on the way out. What the bits sound like is up to what's
+// made from it, freqoutT for a WAV in a given sample format, cswout and
+// uefout for the tape images. newFreqout picks the freqoutT.
+//
+class freqout
+{
+public:
+	/* From some old text or other (ATAP probably):
+
+		A logic 0 consists of 4 cycles of a 1.2 kHz tone,
+		and a logic 1 consists of 8 cycles of a 2.4 kHz tone.
+
+		Each byte of data is preceeded by a logic zero start bit,
+		and is terminated by a logic 1 stop bit.
+	*/
+
+	// 1 cycle of 1200hz = 36.75 samples @ 44100hz
+	// 36.75 * 4 = 147 samples
+	//
+	// 1 cycle of 2400hz = 18.375 samples @ 44100hz
+	// 18.375 * 8 = 147 samples
+	//
+	// Other rates needn't divide up so neatly, see freqoutT::synthBit.
+
+	// Bit position (0..7) to mask
+	//
+	inline BYTE _BV(int x) const
+	{
+		return (BYTE)(1 << x);
+	}
+
+	// 'formatTag' is the WAV's, 1 for pcm or 3 for float.
+	//
+	freqout(BYTE* rawdata, std::ostream& out, int sampleRate, int bitsPerSample, int formatTag) :
+		_formatTag(formatTag),
+		_rawData(rawdata),
+		_loader(NULL),
+		_writtenSampleCount(0),
+		_declaredSampleCount(-1),
+		_wave64(false),
+		_out(out),
+		_used(0),
+		_direct(NULL),
+		_tap(NULL)
+	{
+		// Line the buffer up on a page, the OS is happier copying from there.
+		//
+		_bufferStore.resize(BUFFERSIZE + 4096);
+		_buffer = &_bufferStore[0] + ((4096 - ((size_t)&_bufferStore[0] & 4095)) & 4095);
+
+		BITSPERSAMPLE = bitsPerSample;
+		SAMPLERATE = sampleRate;
+
+		setBitModel(300, 8, 4);
+	}
+
+	virtual ~freqout()
+	{
+		flush();
+	}
+
+
+	// Everything goes out through here. It's collected in the buffer and
+	// written in big lumps, the stream only gets a call every megabyte.
+	// Or if _direct is set it's copied straight there, say into a mapped
+	// file, and the stream's left alone.
+	//
+	void put(const char* data, size_t length)
+	{
+		if (_direct)
+		{
+			memcpy(_direct, data, length);
+			_direct += length;
+			return;
+		}
+
+		if (_used + length > BUFFERSIZE)
+		{
+			flush();
+		}
+
+		if (length >= BUFFERSIZE)
+		{
+			_out.write(data, (std::streamsize)length);
+			return;
+		}
+
+		memcpy(_buffer + _used, data, length);
+		_used += length;
+	}
+
+	void flush(void)
+	{
+		if (_used)
+		{
+			_out.write(_buffer, (std::streamsize)_used);
+			_used = 0;
+		}
+	}
+
+
+	// How fast the bits go, and how many cycles make a 1 and a 0. A
+	// standard tape is 300 baud, 8 cycles and 4. Bit timing starts afresh
+	// with the new model.
+	//
+	virtual void setBitModel(int baud, int oneCycles, int zeroCycles)
+	{
+		_baud = baud;
+		_cycles[0] = zeroCycles;
+		_cycles[1] = oneCycles;
+		_phase = 0;
+	}
+
+	// Samples in 'format' back to 16 bit.
+	//
+	template <class format>
+	static void decodeAs(const char* in, size_t count, short* out)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			out[i] = format::decode(in + i * format::BYTES);
+		}
+	}
+
+	// Level of the current sample of a bit of 'cycles' cycles.
+	//
+	bool isHigh(int cycles) const
+	{
+		return toneIsHigh(cycles, _phase, SAMPLERATE);
+	}
+
+	// Moves on a sample. True if that was the last one of the bit.
+	//
+	bool nextSample(void)
+	{
+		_phase += _baud;
+		if (_phase >= SAMPLERATE)
+		{
+			_phase -= SAMPLERATE;
+			return true;
+		}
+		return false;
+	}
+
+
+	// Output a byte plus its surrounding start & stop bit.
+	// Add the byte's value to the rolling checksum.
+	//
+	virtual void outByte(BYTE value) = 0;
+
+
+	// Bits of tone in 'time' ms, 3 1/3ms each at 300 baud. Tone comes in
+	// whole bits, so that's rounded up.
+	//
+	int toneBits(int time) const
+	{
+		return toneBits(time, _baud);
+	}
+
+	int toneBits(int time, int baud) const
+	{
+		return (int)(((long long)time * baud + 999) / 1000);
+	}
+
+	// Output 'time' ms of high tone, leader or gap.
+	//
+	virtual void outTone(int time) = 0;
+
+
+	// Samples in 'time' ms of silence.
+	//
+	long long gapSamples(int time) const
+	{
+		return (long long)time * SAMPLERATE / 1000;
+	}
+
+	// Output 'time' ms of silence, as goes between the programs on a
+	// compilation tape. Bit timing starts afresh after it, so what comes
+	// next is the same whatever came before.
+	//
+	virtual void outGap(int time) = 0;
+
+
+	// Write one named block: leader, header, gap, data and checksum.
+	// 'leaderTime' and 'gapTime' are in ms.
+	//
+	void writeBlock(const char* name, BYTE flags, int blockNum, int blockLen, int execAddr, int loadAddr, const BYTE* data, int leaderTime, int gapTime)
+	{
+		outTone(leaderTime);
+
+		_checksum = 0;
+
+		// Preamble
+		//
+		outByte('*');
+		outByte('*');
+		outByte('*');
+		outByte('*');
+
+		// Header max 14 chars, including terminator.
+		//
+		for (int i = 0; i < 14 && name[i]; ++i)
+		{
+			outByte(name[i]);
+		}
+		outByte(0x0d);
+
+		/* - Header format:
+		<*>                      )
+		<*>                      )
+		<*>                      )
+		<*>                      ) Header preamble
+		<Filename>               ) Name is 1 to 13 bytes long
+		<Status Flag>            ) Bit 7 clear if last block
+		                         ) Bit 6 clear to skip block
+		                         ) Bit 5 clear if first block
+		<MSB block number>       ) Always zero
+		<LSB block number>
+		<Bytes in block>
+		<MSB run address>
+		<LSB run address>
+		<MSB block load address>
+		<LSB block load address>
+		*/
+
+		outByte(flags);
+		outByte((blockNum & 0xff00) >> 8);
+		outByte(blockNum & 0xff);
+		outByte(blockLen-1);
+		outByte((execAddr & 0xff00) >> 8);
+		outByte(execAddr & 0xff);
+		outByte((loadAddr & 0xff00) >> 8);
+		outByte(loadAddr & 0xff);
+
+		// Header/data gap.
+		//
+		outTone(gapTime);
+
+		// Now for the data. You know you want it.
+		//
+		for (int i = 0; i < blockLen; ++i)
+		{
+			outByte(data[i]);
+		}
+
+		// The checksum itself gets added to the internal count, but not
+		// until after it's written. It's reset again at the start of the
+		// next block. So go ahead, corrupt it all you like.
+		//
+		outByte(_checksum);
+	}
+
+
+	// Bits in a block as writeBlock writes it.
+	//
+	int blockBits(const char* name, int blockLen, int leaderTime, int gapTime) const
+	{
+		// Preamble, name and terminator, header, data and checksum.
+		//
+		int bytes = headerBytes(name) + blockLen + 1;
+		return toneBits(leaderTime) + toneBits(gapTime) + bytes * 10;
+	}
+
+	// Bytes from the start of the preamble to the end of the header.
+	//
+	int headerBytes(const char* name) const
+	{
+		return 4 + nameLength(name) + 1 + 8;
+	}
+
+	// Names go on tape 14 chars at most.
+	//
+	int nameLength(const char* name) const
+	{
+		int nameLen = 0;
+		while (nameLen < 14 && name[nameLen])
+		{
+			++nameLen;
+		}
+		return nameLen;
+	}
+
+	// Samples in the first 'bits' bits of the tape. All the same length
+	// or not, the first n of them end at n/_baud seconds.
+	//
+	long long bitsToSamples(long long bits) const
+	{
+		return bitsToSamples(bits, _baud);
+	}
+
+	long long bitsToSamples(long long bits, int baud) const
+	{
+		return (bits * SAMPLERATE + baud - 1) / baud;
+	}
+
+
+	// A block of the tape as write() lays it out, and the bit it starts
+	// on. All there is to know to render it on its own.
+	//
+	struct blockplan
+	{
+		const char* name;
+		BYTE flags;
+		int number;
+		int length;
+		int execAddress;
+		int loadAddress;
+		const BYTE* data;
+		int leaderTime;
+		int gapTime;
+		long long firstBit;
+	};
+
+	// Splits the program up into blocks, and returns how many bits the
+	// lot comes to.
+	//
+	long long planBlocks(const tapetiming& timing, std::vector<blockplan>& blocks) const
+	{
+		return planBlocks(_loader ? _loader : _rawData, timing, blocks);
+	}
+
+	long long planBlocks(BYTE* program, const tapetiming& timing, std::vector<blockplan>& blocks) const
+	{
+		BYTE* data = program;
+		atmheader atm;
+		atm.read(data);
+
+		// Keep the name with the program, not on our stack.
+		//
+		const char* name = ((const ATMHEADER*)program)->filename;
+
+		BYTE* dataEnd = data + atm.header.length;
+
+		blocks.clear();
+
+		// Bit 7 = last block. Clear = last block.
+		// Bit 6 = do load me. Set = load. Clear = don't.
+		// Bit 5 = first block. Clear = first block.
+		//
+		BYTE flags = _BV(7) | _BV(6);
+
+		int headerTime = timing.lead;
+
+		long long bits = 0;
+		while (flags & _BV(7))
+		{
+			int blockLen = int(dataEnd - data);
+			if (blockLen < 257)
+			{
+				// flags.7 cleared to indicate last block
+				//
+				flags &= ~_BV(7);
+			}
+			else if (blockLen > 256)
+			{
+				// Blocks are 256 bytes max.
+				//
+				blockLen = 256;
+			}
+
+			blockplan block;
+			block.name = name;
+			block.flags = flags;
+			block.number = int(blocks.size()) & 0xff;
+			block.length = blockLen;
+			block.execAddress = atm.header.exec;
+			block.loadAddress = atm.header.start + 0x100 * int(blocks.size());
+			block.data = data;
+			block.leaderTime = headerTime;
+			block.gapTime = timing.gap;
+			block.firstBit = bits;
+			blocks.push_back(block);
+
+			bits += blockBits(name, blockLen, headerTime, timing.gap);
+
+			data += 0x100;
+
+			// flags.5 is clear on first block
+			//
+			flags |= _BV(5);
+
+			headerTime = timing.leader;
+		}
+
+		return bits;
+	}
+
+
+	// How many samples write() or writeunnamed() will come to. It's all
+	// fixed by the header, so the WAV header can go out with the right
+	// sizes in it first time round.
+	//
+	long long tapeSamples(const tapetiming& timing, bool unnamed) const
+	{
+		if (unnamed)
+		{
+			BYTE* data = _rawData;
+			atmheader atm;
+			atm.read(data);
+
+			// Leader, address header, data.
+			//
+			return bitsToSamples(toneBits(timing.lead) + (4 + atm.header.length) * 10);
+		}
+
+		std::vector<blockplan> blocks;
+		long long samples = bitsToSamples(planBlocks(timing, blocks));
+		if (_loader)
+		{
+			samples += bitsToSamples(turboBits(timing), TURBO_BAUD);
+		}
+		return samples;
+	}
+
+
+	// Write atom formatted data to the wave file.
+	//
+	bool write(const tapetiming& timing)
+	{
+		std::vector<blockplan> blocks;
+		planBlocks(timing, blocks);
+
+		for (size_t i = 0; i < blocks.size(); ++i)
+		{
+			writeBlock(blocks[i]);
+		}
+
+		if (_loader)
+		{
+			writeTurbo(timing);
+		}
+
+		return true;
+	}
+
+	void writeBlock(const blockplan& block)
+	{
+		writeBlock(block.name, block.flags, block.number, block.length, block.execAddress,
+			block.loadAddress, block.data, block.leaderTime, block.gapTime);
+	}
+
+
+	// The turbo half of a turbo tape, which follows the loader write()
+	// puts out when _loader is set (see turboloader.h). A leader, then a
+	// block per 256 bytes of the program: a '*' to sync on, the data and
+	// its checksum. There's no header, the loader knows where it all goes.
+	//
+	void writeTurbo(const tapetiming& timing)
+	{
+		BYTE* data = _rawData;
+		atmheader atm;
+		atm.read(data);
+
+		setBitModel(TURBO_BAUD, TURBO_ONECYCLES, TURBO_ZEROCYCLES);
+
+		outTone(timing.leader);
+
+		for (int offset = 0; offset < atm.header.length; offset += 256)
+		{
+			int blockLen = atm.header.length - offset < 256 ? atm.header.length - offset : 256;
+
+			outByte('*');
+			_checksum = 0;
+			for (int i = 0; i < blockLen; ++i)
+			{
+				outByte(data[offset + i]);
+			}
+			outByte(_checksum);
+		}
+
+		setBitModel(300, 8, 4);
+	}
+
+	// Bits in the turbo half of the tape, at TURBO_BAUD.
+	//
+	long long turboBits(const tapetiming& timing) const
+	{
+		atmheader atm;
+		BYTE* data = _rawData;
+		atm.read(data);
+
+		int blocks = (atm.header.length + 255) / 256;
+		return toneBits(timing.leader, TURBO_BAUD) + (long long)(atm.header.length + 2 * blocks) * 10;
+	}
+
+
+	// A place on the tape worth finding again: where a block's leader,
+	// header or data starts. WAVs carry them as cue points so a player
+	// can skip straight to a block.
+	//
+	struct cuepoint
+	{
+		long long sample;
+		int block;
+		const char* part;
+		std::string label;
+	};
+
+	// Cue points for the program, which starts 'start' samples into the
+	// tape. They're labelled with the name on the tape, or 'program' if
+	// there isn't one.
+	//
+	void planCues(const tapetiming& timing, bool unnamed, long long start, const std::string& program, std::vector<cuepoint>& cues) const
+	{
+		if (unnamed)
+		{
+			// Leader, then the address header and the data straight after.
+			//
+			long long header = toneBits(timing.lead);
+			addCue(cues, start, -1, "leader", program);
+			addCue(cues, start + bitsToSamples(header), -1, "header", program);
+			addCue(cues, start + bitsToSamples(header + 4 * 10), -1, "data", program);
+			return;
+		}
+
+		std::vector<blockplan> blocks;
+		long long bits = planBlocks(timing, blocks);
+
+		for (size_t i = 0; i < blocks.size(); ++i)
+		{
+			const blockplan& block = blocks[i];
+			long long header = block.firstBit + toneBits(block.leaderTime);
+			long long data = header + headerBytes(block.name) * 10 + toneBits(block.gapTime);
+
+			std::string name(block.name, nameLength(block.name));
+			addCue(cues, start + bitsToSamples(block.firstBit), (int)i, "leader", name);
+			addCue(cues, start + bitsToSamples(header), (int)i, "header", name);
+			addCue(cues, start + bitsToSamples(data), (int)i, "data", name);
+		}
+
+		// After a turbo loader, the turbo leader and where its data starts.
+		//
+		if (_loader)
+		{
+			long long turbo = start + bitsToSamples(bits);
+			std::string name = std::string(blocks[0].name, nameLength(blocks[0].name)) + " turbo";
+			addCue(cues, turbo, -1, "leader", name);
+			addCue(cues, turbo + bitsToSamples(toneBits(timing.leader, TURBO_BAUD), TURBO_BAUD), -1, "data", name);
+		}
+	}
+
+	void addCue(std::vector<cuepoint>& cues, long long sample, int block, const char* part, const std::string& program) const
+	{
+		cuepoint cue;
+		cue.sample = sample;
+		cue.block = block;
+		cue.part = part;
+		cue.label = program + (block < 0 ? std::string() : " block " + std::to_string(block)) + " " + part;
+		cues.push_back(cue);
+	}
+
+	// Cue positions are DWORDs. An RF64 can run past that, the cues out
+	// there are left for the JSON sidecar, which has them all. The rest
+	// keep their ids from it.
+	//
+	static bool cueFits(const cuepoint& cue)
+	{
+		return cue.sample <= 0xffffffffLL;
+	}
+
+	int cueCount(void) const
+	{
+		int count = 0;
+		for (size_t i = 0; i < _cues.size(); ++i)
+		{
+			count += cueFits(_cues[i]) ? 1 : 0;
+		}
+		return count;
+	}
+
+	// Size of the cue and LIST/adtl chunks that writeCues makes. Labels
+	// are zero terminated and padded to an even length. Wave64 gets none,
+	// there's no agreeing on what its cue chunks look like.
+	//
+	int cueChunkBytes(void) const
+	{
+		int count = cueCount();
+		if (!count || _wave64)
+		{
+			return 0;
+		}
+
+		int bytes = 12 + 24 * count + 12;
+		for (size_t i = 0; i < _cues.size(); ++i)
+		{
+			if (cueFits(_cues[i]))
+			{
+				int length = (int)_cues[i].label.size() + 1;
+				bytes += 12 + length + (length & 1);
+			}
+		}
+		return bytes;
+	}
+
+	// The cue points go after the sample data, a cue chunk with where
+	// each is and a LIST/adtl chunk with what they are.
+	//
+	void writeCues(void)
+	{
+		int count = cueCount();
+		if (!count || _wave64)
+		{
+			return;
+		}
+
+		put("cue ", 4);
+		out32(4 + 24 * count);
+		out32(count);
+		for (size_t i = 0; i < _cues.size(); ++i)
+		{
+			if (cueFits(_cues[i]))
+			{
+				out32((int)i + 1);				// id, as in the sidecar
+				out32((int)_cues[i].sample);	// play order position
+				put("data", 4);
+				out32(0);					// chunk start
+				out32(0);					// block start
+				out32((int)_cues[i].sample);	// sample offset
+			}
+		}
+
+		put("LIST", 4);
+		out32(cueChunkBytes() - (12 + 24 * count) - 8);
+		put("adtl", 4);
+		for (size_t i = 0; i < _cues.size(); ++i)
+		{
+			if (cueFits(_cues[i]))
+			{
+				int length = (int)_cues[i].label.size() + 1;
+				put("labl", 4);
+				out32(4 + length);
+				out32((int)i + 1);
+				put(_cues[i].label.c_str(), length);
+				if (length & 1)
+				{
+					put("", 1);
+				}
+			}
+		}
+	}
+
+
+	// Where a bit falls: the first sample of it, and the phase that
+	// sample has (see freqoutT::synthBit). Lets a stretch of tape be
+	// rendered without rendering all that comes before it.
+	//
+	long long bitStart(long long bit, int& phase) const
+	{
+		long long sample = (bit * SAMPLERATE + _baud - 1) / _baud;
+		phase = int(sample * _baud - bit * SAMPLERATE);
+		return sample;
+	}
+
+
+
+
+	// Write atom formatted data to the wave file - unnamed mode
+	//
+	bool writeunnamed(const tapetiming& timing)
+	{
+		atmheader atm;
+		atm.read(_rawData);
+
+		BYTE* dataEnd = _rawData + atm.header.length;
+
+		int blockLoadAddr = atm.header.start;
+		int blockEndAddr = blockLoadAddr + atm.header.length;
+
+		outTone(timing.lead);
+
+		outByte(blockEndAddr / 256);
+		outByte(blockEndAddr % 256);
+		outByte(blockLoadAddr / 256);
+		outByte(blockLoadAddr % 256);
+
+		for (int i = 0; i < atm.header.length; ++i)
+		{
+			outByte(_rawData[i]);
+		}
+
+		return true;
+	}
+
+
+	// WAVs are little endian whatever we're running on.
+
+	void out32(int val)
+	{
+		char chars[4];
+		chars[0] = (char)(val & 255);
+		chars[1] = (char)((val >> 8) & 255);
+		chars[2] = (char)((val >> 16) & 255);
+		chars[3] = (char)((val >> 24) & 255);
+		put(chars, 4);
+	}
+
+	void out16(short val)
+	{
+		char chars[2];
+		chars[0] = (char)(val & 255);
+		chars[1] = (char)((val >> 8) & 255);
+		put(chars, 2);
+	}
+
+	void out64(long long val)
+	{
+		out32((int)(val & 0xffffffff));
+		out32((int)(val >> 32));
+	}
+
+	// How the samples are wrapped. RIFF sizes are 32 bits, so a WAV over
+	// 4GB is RF64 instead: the same but for a ds64 chunk up front with
+	// the real sizes in, the 32 bit ones all set to -1. Wave64 is Sony's
+	// take on the same thing, all 64 bit with GUIDs for chunk names.
+	//
+	enum wavekind { WAVE_RIFF, WAVE_RF64, WAVE_W64 };
+
+	wavekind waveKind(long long samples) const
+	{
+		if (_wave64)
+		{
+			return WAVE_W64;
+		}
+
+		long long bytes = samples < 0 ? 0 : samples * (BITSPERSAMPLE / 8);
+		return bytes + 36 + trailerBytes(bytes) > 0xffffffffLL ? WAVE_RF64 : WAVE_RIFF;
+	}
+
+	// Where the samples start.
+	//
+	int waveHeaderBytes(long long samples) const
+	{
+		static const int bytes[] = { 44, 80, 104 };
+		return bytes[waveKind(samples)];
+	}
+
+	// Wave64 chunk names. The RIFF ones are the fourcc with a fixed tail,
+	// the riff one's its own.
+	//
+	void putGuid(const char* fourcc)
+	{
+		static const char riff[12] = { '\x2e', '\x91', '\xcf', '\x11', '\xa5', '\xd6', '\x28', '\xdb', '\x04', '\xc1', '\x00', '\x00' };
+		static const char wave[12] = { '\xf3', '\xac', '\xd3', '\x11', '\x8c', '\xd1', '\x00', '\xc0', '\x4f', '\x8e', '\xdb', '\x8a' };
+		put(fourcc, 4);
+		put(strcmp(fourcc, "riff") == 0 ? riff : wave, 12);
+	}
+
+	// What comes after 'bytes' of samples: Wave64 chunks are 8 byte
+	// aligned so that's padded, WAVs get their cue points. RIFF chunks
+	// are word aligned, so an odd length of 8 bit samples needs a pad
+	// byte before them.
+	//
+	long long trailerBytes(long long bytes) const
+	{
+		if (_wave64)
+		{
+			return (8 - (bytes & 7)) & 7;
+		}
+
+		int cues = cueChunkBytes();
+		return cues ? (bytes & 1) + cues : 0;
+	}
+
+	// The whole file, 'samples' long.
+	//
+	long long waveFileBytes(long long samples) const
+	{
+		long long bytes = samples * (BITSPERSAMPLE / 8);
+		return waveHeaderBytes(samples) + bytes + trailerBytes(bytes);
+	}
+
+	void writeTrailer(long long samples)
+	{
+		long long bytes = samples * (BITSPERSAMPLE / 8);
+		char pad[8] = { 0 };
+		put(pad, (size_t)(trailerBytes(bytes) - cueChunkBytes()));
+
+		writeCues();
+	}
+
+	// If we know how many samples are coming the header's right from the
+	// start and the output can be a pipe. If not, pass -1 and it'll be
+	// patched up by finaliseWaveFile. That's always RIFF, being too late
+	// to make room for a ds64 by then: past 4GB the sizes are left at -1,
+	// as for a stream.
+	//
+	virtual void createWaveFile(long long samples = -1)
+	{
+		_declaredSampleCount = samples;
+		long long bytes = samples < 0 ? 0 : samples * (BITSPERSAMPLE / 8);
+		wavekind kind = waveKind(samples);
+
+		int BYTERATE = SAMPLERATE*(BITSPERSAMPLE / 8 * CHANNELS);
+		short BLOCKALIGN = BITSPERSAMPLE / 8 * CHANNELS;
+
+		if (kind == WAVE_W64)
+		{
+			putGuid("riff");
+			out64(waveFileBytes(samples < 0 ? 0 : samples));
+			putGuid("wave");
+
+			putGuid("fmt ");
+			out64(24 + 16);
+		}
+		else
+		{
+			// chunk descriptor
+			put(kind == WAVE_RF64 ? "RF64" : "RIFF", 4);
+			out32(kind == WAVE_RF64 ? -1 : (int)(bytes + 36 + trailerBytes(bytes)));
+			put("WAVE", 4);
+
+			if (kind == WAVE_RF64)
+			{
+				put("ds64", 4);
+				out32(28);
+				out64(bytes + 72 + trailerBytes(bytes));
+				out64(bytes);
+				out64(samples);
+				out32(0);			// no table of other big chunks
+			}
+
+			// sub chunk descriptor
+			put("fmt ", 4);
+			out32(16);			// chunk size, bytes
+		}
+
+		out16(_formatTag);		// format, 1 pcm or 3 float
+		out16(CHANNELS);
+		out32(SAMPLERATE);
+		out32(BYTERATE);
+		out16(BLOCKALIGN);		// block align
+		out16(BITSPERSAMPLE);
+
+		// chunk descriptor
+		if (kind == WAVE_W64)
+		{
+			putGuid("data");
+			out64(24 + bytes);
+		}
+		else
+		{
+			put("data", 4);
+			out32(kind == WAVE_RF64 ? -1 : (int)bytes);
+		}
+	}
+
+
+	virtual void finaliseWaveFile()
+	{
+		writeTrailer(_writtenSampleCount);
+		flush();
+
+		if (_writtenSampleCount == _declaredSampleCount)
+		{
+			_out.flush();
+			return;
+		}
+
+		long long bytesWrit = _writtenSampleCount * (BITSPERSAMPLE / 8);
+		switch (waveKind(_declaredSampleCount))
+		{
+		case WAVE_W64:
+			_out.seekp(16);
+			out64(waveFileBytes(_writtenSampleCount));
+			flush();
+			_out.seekp(96);
+			out64(24 + bytesWrit);
+			break;
+
+		case WAVE_RF64:
+			_out.seekp(20);
+			out64(bytesWrit + 72 + trailerBytes(bytesWrit));
+			out64(bytesWrit);
+			out64(_writtenSampleCount);
+			break;
+
+		default:
+		{
+			bool big = bytesWrit + 36 + trailerBytes(bytesWrit) > 0xffffffffLL;
+			_out.seekp(40);
+			out32(big ? -1 : (int)bytesWrit);
+			flush();
+
+			_out.seekp(4);
+			out32(big ? -1 : (int)(bytesWrit + 36 + trailerBytes(bytesWrit)));
+			break;
+		}
+		}
+		flush();
+	}
+
+	// OK IT'S SAFE TO LOOK AGAIN
+
+	int _formatTag;
+
+	int _baud;
+	int _cycles[2];
+	int _phase;
+
+	BYTE* _rawData;
+
+	// Set for a turbo tape, the loader to go ahead of _rawData.
+	//
+	BYTE* _loader;
+
+	std::vector<cuepoint> _cues;
+
+	long long _writtenSampleCount;
+	long long _declaredSampleCount;
+
+	// Write Sony Wave64 rather than RIFF. See createWaveFile.
+	//
+	bool _wave64;
+
+	BYTE _checksum;
+
+	std::ostream& _out;
+
+	std::vector<char> _bufferStore;
+	char* _buffer;
+	size_t _used;
+	char* _direct;
+	queuetape* _tap;
+
+	static const size_t BUFFERSIZE = 1 << 20;
+
+	static const int CHANNELS = 1;
+	int SAMPLERATE;
+	int BITSPERSAMPLE;
+};
+
+
+// The WAV encoder proper, in one sample format. Everything from a byte
+// down to a sample is fixed at compile time. At the usual rates each bit
+// is copied from a bitshape the compiler made, at any other it's made as
+// it goes with the format's bytes inlined.
+//
+template <class format>
+class freqoutT : public freqout
+{
+public:
+	freqoutT(BYTE* rawdata, std::ostream& out, int sampleRate = 44100) :
+		freqout(rawdata, out, sampleRate, format::BYTES * 8, format::TAG)
+	{
+		// 300 baud is the slowest there is, so the longest bit. Room for
+		// a byte's 10 of them.
+		//
+		_scratch.resize(10 * (SAMPLERATE / 300 + 1) * format::BYTES);
+		findShapes();
+	}
+
+	virtual void setBitModel(int baud, int oneCycles, int zeroCycles)
+	{
+		freqout::setBitModel(baud, oneCycles, zeroCycles);
+		findShapes();
+	}
+
+	// The bit shapes for this rate and bit model, if there are any made.
+	// Standard tapes at 44.1, 48 and 96khz, turbo at 48 and 96. 44.1khz
+	// isn't a multiple of 1200 baud.
+	//
+	void findShapes(void)
+	{
+		_shape[0] = NULL;
+		_shape[1] = NULL;
+
+		useShapes<44100, 300, 8, 4>() ||
+			useShapes<48000, 300, 8, 4>() ||
+			useShapes<96000, 300, 8, 4>() ||
+			useShapes<48000, TURBO_BAUD, TURBO_ONECYCLES, TURBO_ZEROCYCLES>() ||
+			useShapes<96000, TURBO_BAUD, TURBO_ONECYCLES, TURBO_ZEROCYCLES>();
+	}
+
+	template <int rate, int baud, int oneCycles, int zeroCycles>
+	bool useShapes(void)
+	{
+		if (SAMPLERATE != rate || _baud != baud || _cycles[1] != oneCycles || _cycles[0] != zeroCycles)
+		{
+			return false;
+		}
+
+		_shape[0] = bitshape<format, rate, baud, zeroCycles>::data;
+		_shape[1] = bitshape<format, rate, baud, oneCycles>::data;
+		_shapeSamples = rate / baud;
+		memset(_framed, 0, sizeof(_framed));
+		_tone.clear();
+		return true;
+	}
+
+	// A byte's frame from the shapes, start bit, data bits lsb first and
+	// stop bit. Each is put together the first time the byte's written
+	// and kept for the next, so what isn't written is never made.
+	//
+	const char* frame(BYTE value)
+	{
+		size_t bitBytes = _shapeSamples * format::BYTES;
+		if (_frames.size() < 256 * 10 * bitBytes)
+		{
+			_frames.resize(256 * 10 * bitBytes);
+		}
+
+		char* frame = &_frames[value * 10 * bitBytes];
+		if (!_framed[value])
+		{
+			int bits = (value << 1) | 0x200;
+			for (int i = 0; i < 10; ++i)
+			{
+				memcpy(frame + i * bitBytes, _shape[(bits >> i) & 1], bitBytes);
+			}
+			_framed[value] = true;
+		}
+		return frame;
+	}
+
+	// TONEBITS 1 bits from the shapes, made the first time there's tone.
+	//
+	const char* tone(void)
+	{
+		size_t bitBytes = _shapeSamples * format::BYTES;
+		if (_tone.empty())
+		{
+			_tone.resize(TONEBITS * bitBytes);
+			for (int i = 0; i < TONEBITS; ++i)
+			{
+				memcpy(&_tone[i * bitBytes], _shape[1], bitBytes);
+			}
+		}
+		return &_tone[0];
+	}
+
+	// Renders one bit into 'out', returns how many samples that took.
+	//
+	// A bit lasts 1/_baud of a second, SAMPLERATE/_baud samples whether
+	// that's a whole number or not. _phase is the time through the current
+	// bit: it steps _baud a sample and wraps at SAMPLERATE at the end of
+	// the bit, so it never drifts however long the tape. A 1 is 8 cycles
+	// and a 0 is 4 at 300 baud, which puts the tone's own phase at cycles *
+	// _phase, and the first half of every cycle is low.
+	//
+	// At 44.1khz that comes out sample for sample the same as the old
+	// 147 sample table did. How many samples the bit takes is known up
+	// front, so the loop is a plain count.
+	//
+	int synthBit(int bit, char* out)
+	{
+		int cycles = _cycles[bit];
+		int samples = (SAMPLERATE - _phase + _baud - 1) / _baud;
+
+		for (int i = 0, phase = _phase; i < samples; ++i, phase += _baud)
+		{
+			bool high = toneIsHigh(cycles, phase, SAMPLERATE);
+			for (int n = 0; n < format::BYTES; ++n)
+			{
+				out[i * format::BYTES + n] = format::byte(high, n);
+			}
+		}
+
+		_phase += samples * _baud - SAMPLERATE;
+		return samples;
+	}
+
+	// Sample data, as opposed to headers and such. If there's a _tap on
+	// the output the samples go there too, as 16 bit.
+	//
+	void putSamples(const char* data, size_t length)
+	{
+		put(data, length);
+
+		if (_tap)
+		{
+			short samples[4096];
+			size_t count = length / format::BYTES;
+			while (count)
+			{
+				size_t n = count < 4096 ? count : 4096;
+				decodeAs<format>(data, n, samples);
+				_tap->push(samples, n);
+				data += n * format::BYTES;
+				count -= n;
+			}
+		}
+	}
+
+	// Output up to 10 bits of 'bits', lsb first, made in _scratch and
+	// written in one go.
+	//
+	void outBits(int bits, int count)
+	{
+		int samples = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			samples += synthBit((bits >> i) & 1, &_scratch[samples * format::BYTES]);
+		}
+		putSamples(&_scratch[0], samples * format::BYTES);
+		_writtenSampleCount += samples;
+	}
+
+	virtual void outByte(BYTE value)
+	{
+		if (_shape[0])
+		{
+			putSamples(frame(value), 10 * _shapeSamples * format::BYTES);
+			_writtenSampleCount += 10 * _shapeSamples;
+		}
+		else
+		{
+			// Start bit, data bits lsb first, stop bit.
+			//
+			outBits((value << 1) | 0x200, 10);
+		}
+
+		_checksum += value;
+	}
+
+	virtual void outTone(int time)
+	{
+		int bits = toneBits(time);
+		if (_shape[1])
+		{
+			while (bits)
+			{
+				int chunk = bits < TONEBITS ? bits : TONEBITS;
+				putSamples(tone(), chunk * _shapeSamples * format::BYTES);
+				_writtenSampleCount += chunk * _shapeSamples;
+				bits -= chunk;
+			}
+			return;
+		}
+
+		while (bits)
+		{
+			int chunk = bits < 10 ? bits : 10;
+			outBits(0x3ff, chunk);
+			bits -= chunk;
+		}
+	}
+
+	virtual void outGap(int time)
+	{
+		char silence[4096];
+		memset(silence, format::silence(), sizeof(silence));
+
+		long long samples = gapSamples(time);
+		_writtenSampleCount += samples;
+
+		while (samples)
+		{
+			int n = samples < 4096 / format::BYTES ? (int)samples : 4096 / format::BYTES;
+			putSamples(silence, n * format::BYTES);
+			samples -= n;
+		}
+
+		_phase = 0;
+	}
+
+	std::vector<char> _scratch;
+
+	// Each bit's samples, or NULL if they're synthesised.
+	//
+	const char* _shape[2];
+	int _shapeSamples;
+
+	std::vector<char> _frames;
+	bool _framed[256];
+	std::vector<char> _tone;
+
+	static const int TONEBITS = 300;
+};
+
+
+class freqout8 : public freqoutT<pcm8>
+{
+public:
+	freqout8(BYTE* rawdata, std::ostream& out, int sampleRate = 44100) :
+		freqoutT<pcm8>(rawdata, out, sampleRate)
+	{
+	}
+};
+
+
+// A freqoutT for 'bitsPerSample', 8, 16, 24 or 32 for float. Anything
+// else gets 16.
+//
+inline freqout* newFreqout(BYTE* rawdata, std::ostream& out, int bitsPerSample = 16, int sampleRate = 44100)
+{
+	switch (bitsPerSample)
+	{
+	case 8:
+		return new freqoutT<pcm8>(rawdata, out, sampleRate);
+	case 24:
+		return new freqoutT<pcm24>(rawdata, out, sampleRate);
+	case 32:
+		return new freqoutT<float32>(rawdata, out, sampleRate);
+	default:
+		return new freqoutT<pcm16>(rawdata, out, sampleRate);
+	}
+}
+
+
+// Compressed square wave, v2. The tape is square already, so rather than
+// samples this keeps the length of each pulse (half cycle) in samples,
+// run length coded. A byte per pulse, or a 0 and 4 bytes for a long one.
+//
+// The pulse count goes in the header, so the pulses are kept until the
+// end and the whole file written then. They're tiny, a 10 minute tape
+// comes to a megabyte or so.
+//
+class cswout : public freqout
+{
+public:
+	cswout(BYTE* rawdata, std::ostream& out, int sampleRate = 44100) :
+		freqout(rawdata, out, sampleRate, 8, 1),
+		_high(false),
+		_pulse(0),
+		_pulseCount(0)
+	{
+	}
+
+	virtual void outByte(BYTE value)
+	{
+		// Start bit, data bits lsb first, stop bit.
+		//
+		int bits = (value << 1) | 0x200;
+		for (int i = 0; i < 10; ++i)
+		{
+			outBit((bits >> i) & 1);
+		}
+		_checksum += value;
+	}
+
+	virtual void outTone(int time)
+	{
+		for (int bits = toneBits(time); bits; --bits)
+		{
+			outBit(1);
+		}
+	}
+
+	// A bit's samples as pulses, a new one at every change of level.
+	//
+	void outBit(int bit)
+	{
+		int cycles = _cycles[bit];
+		do
+		{
+			bool high = isHigh(cycles);
+			if (high != _high)
+			{
+				outPulse();
+				_high = high;
+			}
+			++_pulse;
+			++_writtenSampleCount;
+		}
+		while (!nextSample());
+	}
+
+	// No such thing as silence in a square wave, the level just stays put.
+	//
+	virtual void outGap(int time)
+	{
+		int samples = (int)gapSamples(time);
+		_pulse += samples;
+		_writtenSampleCount += samples;
+		_phase = 0;
+	}
+
+	virtual void createWaveFile(long long /*samples*/ = -1)
+	{
+	}
+
+	virtual void finaliseWaveFile()
+	{
+		outPulse();
+
+		put("Compressed Square Wave\x1a", 23);
+		put("\x02\x00", 2);			// version 2.0
+		out32(SAMPLERATE);
+		out32(_pulseCount);
+		put("\x01", 1);				// RLE
+		put("\x00", 1);				// starts low
+		put("\x00", 1);				// no header extension
+
+		char app[16] = "atm2wav";
+		put(app, 16);
+
+		if (!_pulses.empty())
+		{
+			put((const char*)&_pulses[0], _pulses.size());
+		}
+		flush();
+		_out.flush();
+	}
+
+	void outPulse(void)
+	{
+		if (!_pulse)
+		{
+			return;
+		}
+
+		if (_pulse < 256)
+		{
+			_pulses.push_back((BYTE)_pulse);
+		}
+		else
+		{
+			_pulses.push_back(0);
+			for (int i = 0; i < 4; ++i)
+			{
+				_pulses.push_back((BYTE)(_pulse >> (i * 8)));
+			}
+		}
+
+		++_pulseCount;
+		_pulse = 0;
+	}
+
+	bool _high;
+	int _pulse;
+	int _pulseCount;
+	std::vector<BYTE> _pulses;
+};
+
+// UEF, the Acorn emulators' tape image. No audio, just the bytes in
+// chunks: 0x0100 is data with the start and stop bits left implicit,
+// 0x0110 is carrier tone (leader and gap) in cycles of 2400hz. UEF
+// assumes the BBC's 1200 baud, so a 0x0117 up front makes it 300.
+//
+// Like CSW it's all kept until the end, optionally gzipped as most UEFs
+// are, then written.
+//
+class uefout : public freqout
+{
+public:
+	uefout(BYTE* rawdata, std::ostream& out, bool compress) :
+		freqout(rawdata, out, 44100, 8, 1),
+		_compress(compress)
+	{
+	}
+
+	virtual void outByte(BYTE value)
+	{
+		_data.push_back(value);
+		_checksum += value;
+	}
+
+	// A 1 bit is 8 cycles. Chunk lengths are 16 bit, so very long tones
+	// take more than one.
+	//
+	virtual void outTone(int time)
+	{
+		endData();
+
+		int cycles = toneBits(time) * 8;
+		while (cycles)
+		{
+			int n = cycles < 0xffff ? cycles : 0xffff;
+			BYTE length[2] = { (BYTE)(n & 0xff), (BYTE)(n >> 8) };
+			addChunk(0x0110, length, 2);
+			cycles -= n;
+		}
+	}
+
+	// 0x0112 gaps are in 2400ths of a second, 16 bits of them.
+	//
+	virtual void outGap(int time)
+	{
+		endData();
+
+		int units = (int)((long long)time * 2400 / 1000);
+		while (units)
+		{
+			int n = units < 0xffff ? units : 0xffff;
+			BYTE length[2] = { (BYTE)(n & 0xff), (BYTE)(n >> 8) };
+			addChunk(0x0112, length, 2);
+			units -= n;
+		}
+	}
+
+	virtual void createWaveFile(long long /*samples*/ = -1)
+	{
+		// "UEF File!", terminator, version 0.10
+		//
+		static const BYTE header[12] = { 'U', 'E', 'F', ' ', 'F', 'i', 'l', 'e', '!', 0, 10, 0 };
+		_uef.assign(header, header + 12);
+
+		static const char origin[] = "atm2wav";
+		addChunk(0x0000, (const BYTE*)origin, sizeof(origin));
+
+		BYTE baud[2] = { 300 & 0xff, 300 >> 8 };
+		addChunk(0x0117, baud, 2);
+	}
+
+	virtual void finaliseWaveFile()
+	{
+		endData();
+
+		if (_compress)
+		{
+			std::vector<BYTE> gz;
+			gzip(_uef, gz);
+			_uef.swap(gz);
+		}
+
+		put((const char*)&_uef[0], _uef.size());
+		flush();
+		_out.flush();
+	}
+
+	void endData(void)
+	{
+		if (!_data.empty())
+		{
+			addChunk(0x0100, &_data[0], _data.size());
+			_data.clear();
+		}
+	}
+
+	void addChunk(int id, const BYTE* data, size_t length)
+	{
+		_uef.push_back((BYTE)(id & 0xff));
+		_uef.push_back((BYTE)(id >> 8));
+		for (int i = 0; i < 4; ++i)
+		{
+			_uef.push_back((BYTE)(length >> (i * 8)));
+		}
+		_uef.insert(_uef.end(), data, data + length);
+	}
+
+	bool _compress;
+	std::vector<BYTE> _data;
+	std::vector<BYTE> _uef;
+};
+
+#endif
@@ -0,0 +1,633 @@
+#ifndef __gzip_h
+#define __gzip_h
+
+#include <vector>
+#include <stddef.h>
+#include <string.h>
+
+// Just enough deflate to gzip a tape image. One block, fixed huffman
+// codes, greedy LZ77 matching over the 32k window. Not the tightest
+// squeeze around but it'll do, tape images are mostly repeats.
+//
+// And all of inflate, for reading other people's: stored, fixed and
+// dynamic blocks, bare, zlib wrapped or gzipped. Decoding's a bit at a
+// time, which is slow as these things go but tape images are small.
+//
+// Needs shared/defines.h.
+
+
+// Length and distance code tables, RFC 1951 3.2.5.
+//
+static const int DEFLATE_LENGTHBASE[29] =
+{
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const int DEFLATE_LENGTHEXTRA[29] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const int DEFLATE_DISTBASE[30] =
+{
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const int DEFLATE_DISTEXTRA[30] =
+{
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+
+inline DWORD crc32(const BYTE* data, size_t length, DWORD crc = 0)
+{
+	static DWORD table[256];
+	if (!table[1])
+	{
+		for (DWORD i = 0; i < 256; ++i)
+		{
+			DWORD c = i;
+			for (int k = 0; k < 8; ++k)
+			{
+				c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	for (size_t i = 0; i < length; ++i)
+	{
+		crc = table[(crc ^ data[i]) & 255] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+
+// Deflate's bits go in lsb first, but huffman codes go msb first.
+//
+class deflatebits
+{
+public:
+	deflatebits(std::vector<BYTE>& out) :
+		m_out(out),
+		m_bits(0),
+		m_count(0)
+	{
+	}
+
+	void bits(DWORD value, int count)
+	{
+		m_bits |= value << m_count;
+		m_count += count;
+		while (m_count >= 8)
+		{
+			m_out.push_back((BYTE)m_bits);
+			m_bits >>= 8;
+			m_count -= 8;
+		}
+	}
+
+	void code(DWORD code, int count)
+	{
+		DWORD reversed = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			reversed = (reversed << 1) | ((code >> i) & 1);
+		}
+		bits(reversed, count);
+	}
+
+	// Fixed literal/length code for 'symbol', 0..287.
+	//
+	void symbol(int symbol)
+	{
+		if (symbol < 144)
+		{
+			code(0x30 + symbol, 8);
+		}
+		else if (symbol < 256)
+		{
+			code(0x190 + symbol - 144, 9);
+		}
+		else if (symbol < 280)
+		{
+			code(symbol - 256, 7);
+		}
+		else
+		{
+			code(0xc0 + symbol - 280, 8);
+		}
+	}
+
+	void match(int length, int distance)
+	{
+		int i = 28;
+		while (DEFLATE_LENGTHBASE[i] > length)
+		{
+			--i;
+		}
+		symbol(257 + i);
+		bits(length - DEFLATE_LENGTHBASE[i], DEFLATE_LENGTHEXTRA[i]);
+
+		i = 29;
+		while (DEFLATE_DISTBASE[i] > distance)
+		{
+			--i;
+		}
+		code(i, 5);
+		bits(distance - DEFLATE_DISTBASE[i], DEFLATE_DISTEXTRA[i]);
+	}
+
+	void flush(void)
+	{
+		if (m_count)
+		{
+			m_out.push_back((BYTE)m_bits);
+		}
+		m_bits = 0;
+		m_count = 0;
+	}
+
+	std::vector<BYTE>& m_out;
+	DWORD m_bits;
+	int m_count;
+};
+
+
+// Raw deflate stream of 'data' onto the end of 'out'.
+//
+inline void deflate(const BYTE* data, size_t length, std::vector<BYTE>& out)
+{
+	const int WINDOW = 32768;
+	const int HASHSIZE = 1 << 15;
+	const int MAXCHAIN = 64;
+
+	deflatebits bw(out);
+	bw.bits(1, 1);		// last block
+	bw.bits(1, 2);		// fixed codes
+
+	// Most recent position for each hash of 3 bytes, and for each
+	// position in the window the one before it with the same hash.
+	//
+	std::vector<int> head(HASHSIZE, -1);
+	std::vector<int> prev(WINDOW, -1);
+
+	size_t i = 0;
+	while (i < length)
+	{
+		int bestLength = 0, bestDistance = 0;
+
+		if (i + 3 <= length)
+		{
+			size_t maxLength = length - i < 258 ? length - i : 258;
+			unsigned hash = ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & (HASHSIZE - 1);
+
+			int p = head[hash];
+			for (int chain = 0; p >= 0 && i - p <= WINDOW && chain < MAXCHAIN; ++chain)
+			{
+				size_t n = 0;
+				while (n < maxLength && data[p + n] == data[i + n])
+				{
+					++n;
+				}
+				if ((int)n > bestLength)
+				{
+					bestLength = (int)n;
+					bestDistance = (int)(i - p);
+				}
+
+				// Slots get reused as the window moves on, so a link that
+				// doesn't go backwards is stale.
+				//
+				int next = prev[p & (WINDOW - 1)];
+				if (next >= p)
+				{
+					break;
+				}
+				p = next;
+			}
+		}
+
+		int step = bestLength >= 3 ? bestLength : 1;
+		if (bestLength >= 3)
+		{
+			bw.match(bestLength, bestDistance);
+		}
+		else
+		{
+			bw.symbol(data[i]);
+		}
+
+		for (; step; --step, ++i)
+		{
+			if (i + 3 <= length)
+			{
+				unsigned hash = ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & (HASHSIZE - 1);
+				prev[i & (WINDOW - 1)] = head[hash];
+				head[hash] = (int)i;
+			}
+		}
+	}
+
+	bw.symbol(256);
+	bw.flush();
+}
+
+
+// Wraps 'data' up as a .gz file.
+//
+inline void gzip(const std::vector<BYTE>& data, std::vector<BYTE>& out)
+{
+	static const BYTE header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255 };
+	out.insert(out.end(), header, header + 10);
+
+	const BYTE* bytes = data.empty() ? NULL : &data[0];
+	deflate(bytes, data.size(), out);
+
+	DWORD crc = crc32(bytes, data.size());
+	DWORD size = (DWORD)data.size();
+	for (int i = 0; i < 4; ++i)
+	{
+		out.push_back((BYTE)(crc >> (i * 8)));
+	}
+	for (int i = 0; i < 4; ++i)
+	{
+		out.push_back((BYTE)(size >> (i * 8)));
+	}
+}
+
+
+// Deflate's bits coming back out, lsb first. Reading past the end gives
+// 0s and sets m_overrun.
+//
+class inflatebits
+{
+public:
+	inflatebits(const BYTE* data, size_t length) :
+		m_data(data),
+		m_length(length),
+		m_pos(0),
+		m_bits(0),
+		m_count(0),
+		m_overrun(false)
+	{
+	}
+
+	DWORD bits(int count)
+	{
+		while (m_count < count)
+		{
+			DWORD byte = 0;
+			if (m_pos < m_length)
+			{
+				byte = m_data[m_pos++];
+			}
+			else
+			{
+				m_overrun = true;
+			}
+			m_bits |= byte << m_count;
+			m_count += 8;
+		}
+
+		DWORD value = m_bits & ((1u << count) - 1);
+		m_bits >>= count;
+		m_count -= count;
+		return value;
+	}
+
+	// Stored blocks start on a byte boundary.
+	//
+	void align(void)
+	{
+		m_bits = 0;
+		m_count = 0;
+	}
+
+	const BYTE* m_data;
+	size_t m_length;
+	size_t m_pos;
+	DWORD m_bits;
+	int m_count;
+	bool m_overrun;
+};
+
+
+// A canonical huffman code, RFC 1951 3.2.2. Kept as how many codes there
+// are of each length and the symbols in code order, which is all it
+// takes to decode a bit at a time.
+//
+struct inflatecode
+{
+	short counts[16];
+	short symbols[288];
+
+	// False if the lengths ask for more codes than there are.
+	//
+	bool build(const BYTE* lengths, int n)
+	{
+		memset(counts, 0, sizeof(counts));
+		for (int i = 0; i < n; ++i)
+		{
+			++counts[lengths[i]];
+		}
+		counts[0] = 0;
+
+		int left = 1;
+		for (int len = 1; len < 16; ++len)
+		{
+			left = (left << 1) - counts[len];
+			if (left < 0)
+			{
+				return false;
+			}
+		}
+
+		short offsets[16];
+		offsets[1] = 0;
+		for (int len = 1; len < 15; ++len)
+		{
+			offsets[len + 1] = offsets[len] + counts[len];
+		}
+		for (int i = 0; i < n; ++i)
+		{
+			if (lengths[i])
+			{
+				symbols[offsets[lengths[i]]++] = (short)i;
+			}
+		}
+		return true;
+	}
+
+	// The next symbol, or -1 if the bits aren't a code.
+	//
+	int decode(inflatebits& in) const
+	{
+		int code = 0, first = 0, index = 0;
+		for (int len = 1; len < 16; ++len)
+		{
+			code |= in.bits(1);
+			int count = counts[len];
+			if (code - first < count)
+			{
+				return symbols[index + code - first];
+			}
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+};
+
+
+// Undoes a raw deflate stream onto the end of 'out'. False if it's not
+// deflate or stops short.
+//
+inline bool inflate(const BYTE* data, size_t length, std::vector<BYTE>& out)
+{
+	inflatebits in(data, length);
+
+	bool last;
+	do
+	{
+		last = in.bits(1) != 0;
+		int type = in.bits(2);
+
+		if (type == 0)
+		{
+			// Stored: length, its complement, then the bytes as they are.
+			//
+			in.align();
+			size_t pos = in.m_pos;
+			if (pos + 4 > length)
+			{
+				return false;
+			}
+			int len = data[pos] | (data[pos + 1] << 8);
+			int nlen = data[pos + 2] | (data[pos + 3] << 8);
+			if (len != (~nlen & 0xffff) || pos + 4 + len > length)
+			{
+				return false;
+			}
+			out.insert(out.end(), data + pos + 4, data + pos + 4 + len);
+			in.m_pos = pos + 4 + len;
+			continue;
+		}
+
+		if (type == 3)
+		{
+			return false;
+		}
+
+		BYTE lengths[288 + 32];
+		int nlen = 288, ndist = 30;
+		if (type == 1)
+		{
+			// Fixed codes, 3.2.6.
+			//
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			memset(lengths + 288, 5, 30);
+		}
+		else
+		{
+			// Dynamic codes, 3.2.7. The code lengths are themselves huffman
+			// coded, with run lengths.
+			//
+			static const BYTE order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+			nlen = in.bits(5) + 257;
+			ndist = in.bits(5) + 1;
+			int ncode = in.bits(4) + 4;
+			if (nlen > 286 || ndist > 30)
+			{
+				return false;
+			}
+
+			BYTE codeLengths[19] = { 0 };
+			for (int i = 0; i < ncode; ++i)
+			{
+				codeLengths[order[i]] = (BYTE)in.bits(3);
+			}
+
+			inflatecode lencode;
+			if (!lencode.build(codeLengths, 19))
+			{
+				return false;
+			}
+
+			int i = 0;
+			while (i < nlen + ndist)
+			{
+				int symbol = lencode.decode(in);
+				if (symbol < 0 || in.m_overrun)
+				{
+					return false;
+				}
+
+				if (symbol < 16)
+				{
+					lengths[i++] = (BYTE)symbol;
+					continue;
+				}
+
+				BYTE value = 0;
+				int repeat;
+				if (symbol == 16)
+				{
+					if (i == 0)
+					{
+						return false;
+					}
+					value = lengths[i - 1];
+					repeat = 3 + in.bits(2);
+				}
+				else if (symbol == 17)
+				{
+					repeat = 3 + in.bits(3);
+				}
+				else
+				{
+					repeat = 11 + in.bits(7);
+				}
+
+				if (i + repeat > nlen + ndist)
+				{
+					return false;
+				}
+				while (repeat--)
+				{
+					lengths[i++] = value;
+				}
+			}
+		}
+
+		inflatecode lencode, distcode;
+		if (!lencode.build(lengths, nlen) || !distcode.build(lengths + nlen, ndist))
+		{
+			return false;
+		}
+
+		for (;;)
+		{
+			int symbol = lencode.decode(in);
+			if (symbol < 0 || in.m_overrun)
+			{
+				return false;
+			}
+
+			if (symbol < 256)
+			{
+				out.push_back((BYTE)symbol);
+				continue;
+			}
+			if (symbol == 256)
+			{
+				break;
+			}
+
+			symbol -= 257;
+			if (symbol >= 29)
+			{
+				return false;
+			}
+			int len = DEFLATE_LENGTHBASE[symbol] + in.bits(DEFLATE_LENGTHEXTRA[symbol]);
+
+			int distSymbol = distcode.decode(in);
+			if (distSymbol < 0 || distSymbol >= 30)
+			{
+				return false;
+			}
+			size_t distance = DEFLATE_DISTBASE[distSymbol] + in.bits(DEFLATE_DISTEXTRA[distSymbol]);
+			if (distance > out.size())
+			{
+				return false;
+			}
+
+			// Matches can overlap what they make, so a byte at a time.
+			//
+			size_t from = out.size() - distance;
+			for (int i = 0; i < len; ++i)
+			{
+				BYTE byte = out[from + i];
+				out.push_back(byte);
+			}
+		}
+	}
+	while (!last);
+
+	return !in.m_overrun;
+}
+
+
+// A zlib stream, RFC 1950: a two byte header, deflate, and an Adler-32
+// that goes unchecked. A bad stream won't inflate anyway.
+//
+inline bool unzlib(const BYTE* data, size_t length, std::vector<BYTE>& out)
+{
+	if (length < 2 || (data[0] & 15) != 8 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 0x20))
+	{
+		return false;
+	}
+	return inflate(data + 2, length - 2, out);
+}
+
+
+// A .gz file, RFC 1952. Skips whatever optional fields the header has,
+// inflates and checks the CRC. Only the first member, nobody writes
+// tape images in more than one.
+//
+inline bool gunzip(const BYTE* data, size_t length, std::vector<BYTE>& out)
+{
+	if (length < 18 || data[0] != 0x1f || data[1] != 0x8b || data[2] != 8)
+	{
+		return false;
+	}
+
+	BYTE flags = data[3];
+	size_t pos = 10;
+	if (flags & 4)
+	{
+		pos += 2 + (data[pos] | (data[pos + 1] << 8));
+	}
+	for (int field = 8; field <= 16; field <<= 1)
+	{
+		if (flags & field)
+		{
+			while (pos < length && data[pos])
+			{
+				++pos;
+			}
+			++pos;
+		}
+	}
+	if (flags & 2)
+	{
+		pos += 2;
+	}
+
+	if (pos + 8 > length)
+	{
+		return false;
+	}
+
+	size_t start = out.size();
+	if (!inflate(data + pos, length - pos - 8, out))
+	{
+		return false;
+	}
+
+	// The trailer's at the very end, wherever the deflate stopped.
+	//
+	const BYTE* trailer = data + length - 8;
+	DWORD crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((DWORD)trailer[3] << 24);
+	const BYTE* inflated = out.size() > start ? &out[start] : NULL;
+	return crc32(inflated, out.size() - start) == crc;
+}
+
+#endif
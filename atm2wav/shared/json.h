@@ -0,0 +1,36 @@
+#ifndef __json_h
+#define __json_h
+
+#include <string>
+#include <sstream>
+#include <iomanip>
+
+
+// A string as a JSON string, quotes and all. Names come off disks, tapes
+// and command lines, so they can have anything in them.
+//
+inline std::string jsonString(const std::string& text)
+{
+	std::ostringstream json;
+	json << '"';
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		unsigned char c = text[i];
+		if (c == '"' || c == '\\')
+		{
+			json << '\\' << c;
+		}
+		else if (c < 0x20 || c > 0x7e)
+		{
+			json << "\\u" << std::hex << std::setfill('0') << std::setw(4) << (int)c << std::dec;
+		}
+		else
+		{
+			json << c;
+		}
+	}
+	json << '"';
+	return json.str();
+}
+
+#endif
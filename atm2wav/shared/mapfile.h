@@ -0,0 +1,143 @@
+#ifndef __mapfile_h
+#define __mapfile_h
+
+// A new file of a known size, mapped into memory for writing. The space
+// is allocated up front so writers can fill any part of it in any order.
+//
+// Include this before shared/defines.h, windows.h wants BYTE and friends
+// for its own typedefs.
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <stddef.h>
+
+
+class mapfile
+{
+public:
+	mapfile() :
+		m_data(NULL),
+		m_size(0)
+	{
+#ifdef _WIN32
+		m_file = INVALID_HANDLE_VALUE;
+		m_mapping = NULL;
+#else
+		m_fd = -1;
+#endif
+	}
+
+	~mapfile()
+	{
+		close();
+	}
+
+	// Creates 'name', 'size' bytes long, and maps it. Returns NULL if it
+	// can't do that.
+	//
+	char* create(const char* name, size_t size)
+	{
+		close();
+		m_size = size;
+
+#ifdef _WIN32
+		m_file = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_file == INVALID_HANDLE_VALUE)
+		{
+			return NULL;
+		}
+
+		LARGE_INTEGER length;
+		length.QuadPart = (LONGLONG)size;
+		if (!SetFilePointerEx(m_file, length, NULL, FILE_BEGIN) || !SetEndOfFile(m_file))
+		{
+			close();
+			return NULL;
+		}
+
+		m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READWRITE, length.HighPart, length.LowPart, NULL);
+		if (m_mapping == NULL)
+		{
+			close();
+			return NULL;
+		}
+
+		m_data = (char*)MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, size);
+#else
+		m_fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (m_fd < 0)
+		{
+			return NULL;
+		}
+
+		// Not every filesystem does fallocate. Those that don't get a
+		// sparse file instead, which is just as good to write into.
+		//
+		if (posix_fallocate(m_fd, 0, (off_t)size) != 0 && ftruncate(m_fd, (off_t)size) != 0)
+		{
+			close();
+			return NULL;
+		}
+
+		void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+		m_data = data == MAP_FAILED ? NULL : (char*)data;
+#endif
+
+		if (m_data == NULL)
+		{
+			close();
+		}
+		return m_data;
+	}
+
+	void close(void)
+	{
+#ifdef _WIN32
+		if (m_data)
+		{
+			UnmapViewOfFile(m_data);
+		}
+		if (m_mapping)
+		{
+			CloseHandle(m_mapping);
+		}
+		if (m_file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_file);
+		}
+		m_mapping = NULL;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data)
+		{
+			munmap(m_data, m_size);
+		}
+		if (m_fd >= 0)
+		{
+			::close(m_fd);
+		}
+		m_fd = -1;
+#endif
+		m_data = NULL;
+	}
+
+	char* m_data;
+	size_t m_size;
+
+#ifdef _WIN32
+	HANDLE m_file;
+	HANDLE m_mapping;
+#else
+	int m_fd;
+#endif
+};
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef __tapesource_h
+#define __tapesource_h
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <stddef.h>
+#include <string.h>
+
+// Where the tape decoder gets its samples from.
+//
+// Positions are sample offsets from the start of the tape. Sources hand
+//  out a run of samples at a time, the decoder never needs the whole
+//  tape to hand at once.
+
+
+class pulsetape;
+
+class tapesource
+{
+public:
+	virtual ~tapesource() {}
+
+	// Sources that are pulse lengths to begin with, as a CSW is, hand
+	//  themselves over here so the decoder can take the pulses as they
+	//  are (see cswfile.h). NULL for the rest.
+	//
+	virtual const pulsetape* pulses(void) const
+	{
+		return NULL;
+	}
+
+	// Points 'samples' at the sample at 'pos' and returns how many follow
+	//  it contiguously, counting itself. At least 'want' of them if the tape
+	//  is that long. Returns 0 past the end of the tape.
+	//
+	// The pointer is good until the next call.
+	//
+	virtual size_t fetch(size_t pos, const short*& samples, size_t want = 1) = 0;
+};
+
+
+// A tape that's all in memory already.
+//
+class memorytape : public tapesource
+{
+public:
+	memorytape(const std::vector<short>& samples) :
+		m_samples(samples)
+	{
+	}
+
+	virtual size_t fetch(size_t pos, const short*& samples, size_t /*want*/ = 1)
+	{
+		if (pos >= m_samples.size())
+		{
+			samples = NULL;
+			return 0;
+		}
+
+		samples = &m_samples[pos];
+		return m_samples.size() - pos;
+	}
+
+	const std::vector<short>& m_samples;
+};
+
+
+// A tape that's still being made, on another thread. The maker pushes
+//  samples in, they go across a chunk at a time and the decoder takes
+//  them out through fetch as usual. Only so many chunks are let queue
+//  up, if the decoder falls behind the maker waits for it.
+//
+// Like wavtape, the last part of what's been read is kept on hand for
+//  the decoder to back up into. There's no going back further than that.
+//
+class queuetape : public tapesource
+{
+public:
+	queuetape() :
+		m_ended(false),
+		m_closed(false),
+		m_used(0),
+		m_base(0),
+		m_count(0),
+		m_buffer(BUFFERSAMPLES)
+	{
+	}
+
+	// Maker's side. Samples are collected into a chunk here and handed
+	//  over when there's a chunk's worth.
+	//
+	void push(const short* samples, size_t count)
+	{
+		m_pending.insert(m_pending.end(), samples, samples + count);
+		if (m_pending.size() >= CHUNKSAMPLES)
+		{
+			handOver();
+		}
+	}
+
+	// That's the lot.
+	//
+	void finish(void)
+	{
+		handOver();
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_ended = true;
+		m_changed.notify_all();
+	}
+
+	// Decoder's side, when it's read all it wants. Anything else the
+	//  maker pushes is thrown away rather than waited on.
+	//
+	void close(void)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_closed = true;
+		m_queue.clear();
+		m_changed.notify_all();
+	}
+
+	virtual size_t fetch(size_t pos, const short*& samples, size_t want = 1)
+	{
+		samples = NULL;
+
+		size_t avail = available(pos);
+		if (avail < want && pos >= m_base)
+		{
+			fill(pos, want);
+			avail = available(pos);
+		}
+
+		if (avail)
+		{
+			samples = &m_buffer[pos - m_base];
+		}
+		return avail;
+	}
+
+private:
+	size_t available(size_t pos) const
+	{
+		return pos >= m_base && pos < m_base + m_count ? m_base + m_count - pos : 0;
+	}
+
+	void handOver(void)
+	{
+		if (m_pending.empty())
+		{
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(m_lock);
+		while (m_queue.size() >= MAXCHUNKS && !m_closed)
+		{
+			m_changed.wait(lock);
+		}
+
+		if (!m_closed)
+		{
+			m_queue.push_back(std::vector<short>());
+			m_queue.back().swap(m_pending);
+			m_changed.notify_all();
+		}
+		m_pending.clear();
+	}
+
+	// Next chunk off the queue, waiting for one if need be. False once
+	//  the tape's over.
+	//
+	bool pop(void)
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		while (m_queue.empty() && !m_ended && !m_closed)
+		{
+			m_changed.wait(lock);
+		}
+
+		if (m_queue.empty())
+		{
+			return false;
+		}
+
+		m_chunk.swap(m_queue.front());
+		m_queue.pop_front();
+		m_used = 0;
+		m_changed.notify_all();
+		return true;
+	}
+
+	// Takes samples from the queue until there's 'want' of them from
+	//  'pos' on, or the buffer's full, or the tape's over. Keeps a way
+	//  back from 'pos' and drops anything before that.
+	//
+	void fill(size_t pos, size_t want)
+	{
+		size_t keepFrom = pos > KEEPSAMPLES ? pos - KEEPSAMPLES : 0;
+		if (keepFrom >= m_base + m_count)
+		{
+			m_base += m_count;
+			m_count = 0;
+		}
+		else if (keepFrom > m_base)
+		{
+			m_count -= keepFrom - m_base;
+			memmove(&m_buffer[0], &m_buffer[keepFrom - m_base], m_count * sizeof(short));
+			m_base = keepFrom;
+		}
+
+		while (available(pos) < want && m_count < m_buffer.size())
+		{
+			if (m_used == m_chunk.size() && !pop())
+			{
+				break;
+			}
+
+			size_t n = m_chunk.size() - m_used;
+			if (m_base < keepFrom)
+			{
+				// The decoder's already past these.
+				//
+				if (n > keepFrom - m_base)
+				{
+					n = keepFrom - m_base;
+				}
+				m_base += n;
+			}
+			else
+			{
+				if (n > m_buffer.size() - m_count)
+				{
+					n = m_buffer.size() - m_count;
+				}
+				memcpy(&m_buffer[m_count], &m_chunk[m_used], n * sizeof(short));
+				m_count += n;
+			}
+			m_used += n;
+		}
+	}
+
+	static const size_t CHUNKSAMPLES = 1 << 16;
+	static const size_t MAXCHUNKS = 16;
+	static const size_t BUFFERSAMPLES = 1 << 20;
+	static const size_t KEEPSAMPLES = 1 << 18;
+
+	std::mutex m_lock;
+	std::condition_variable m_changed;
+	std::deque<std::vector<short> > m_queue;
+	bool m_ended;
+	bool m_closed;
+
+	std::vector<short> m_pending;
+
+	std::vector<short> m_chunk;
+	size_t m_used;
+
+	size_t m_base;
+	size_t m_count;
+	std::vector<short> m_buffer;
+};
+
+#endif
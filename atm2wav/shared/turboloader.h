@@ -0,0 +1,96 @@
+#ifndef __turboloader_h
+#define __turboloader_h
+
+#include <vector>
+#include <string.h>
+
+
+// The turbo loader, a 6502 stub that goes on the tape ahead of a program
+// as an ordinary 300 baud file. Run, it reads the rest of the tape four
+// times as fast: 1200 baud, a 1 being 4 cycles of 4800hz and a 0 2
+// cycles of 2400hz. That's the same turbo model cutsbench tests with.
+//
+// The source is loader/turbo.asm, these are the bytes of loader/turbo.bin
+// that it assembles to.
+//
+// Needs shared/defines.h and shared/atmheader.h.
+
+static const int TURBO_BAUD = 1200;
+static const int TURBO_ONECYCLES = 4;
+static const int TURBO_ZEROCYCLES = 2;
+
+// Assembled to load and run here. Zero page from #80 is its workspace.
+//
+static const int TURBO_LOADADDR = 0x0300;
+static const int TURBO_WORKSPACE = 0x0080;
+
+static const BYTE TURBO_LOADER[] =
+{
+	0x4c, 0x09, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x78, 0xad, 0x03,
+	0x03, 0x85, 0x80, 0xad, 0x04, 0x03, 0x85, 0x81, 0xad, 0x07, 0x03, 0x85,
+	0x88, 0xad, 0x02, 0xb0, 0x29, 0x20, 0x85, 0x87, 0x20, 0x84, 0x03, 0xc9,
+	0x2a, 0xd0, 0xf9, 0xf0, 0x07, 0x20, 0x84, 0x03, 0xc9, 0x2a, 0xd0, 0x30,
+	0xa9, 0x00, 0xa6, 0x88, 0xca, 0xd0, 0x03, 0xad, 0x08, 0x03, 0x85, 0x89,
+	0xa0, 0x00, 0x84, 0x82, 0x20, 0x84, 0x03, 0x91, 0x80, 0x18, 0x65, 0x82,
+	0x85, 0x82, 0xc8, 0xc4, 0x89, 0xd0, 0xf1, 0x20, 0x84, 0x03, 0xc5, 0x82,
+	0xd0, 0x0a, 0xe6, 0x81, 0xc6, 0x88, 0xd0, 0xcd, 0x58, 0x6c, 0x05, 0x03,
+	0x20, 0xed, 0xff, 0xa2, 0x00, 0xbd, 0x72, 0x03, 0xf0, 0x06, 0x20, 0xf4,
+	0xff, 0xe8, 0xd0, 0xf5, 0x58, 0x00, 0x54, 0x55, 0x52, 0x42, 0x4f, 0x20,
+	0x4c, 0x4f, 0x41, 0x44, 0x20, 0x46, 0x41, 0x49, 0x4c, 0x45, 0x44, 0x00,
+	0xa2, 0x00, 0x20, 0xc8, 0x03, 0xe0, 0x0b, 0x90, 0xf7, 0xa9, 0x03, 0x85,
+	0x85, 0x20, 0xc8, 0x03, 0xc6, 0x85, 0xd0, 0xf9, 0xa9, 0x08, 0x85, 0x84,
+	0x20, 0xa8, 0x03, 0x66, 0x83, 0xc6, 0x84, 0xd0, 0xf7, 0xa5, 0x83, 0x60,
+	0xa2, 0x00, 0x20, 0xc8, 0x03, 0x20, 0xc8, 0x03, 0xa9, 0x06, 0xe0, 0x12,
+	0x90, 0x02, 0xa9, 0x02, 0x85, 0x85, 0x85, 0x86, 0x20, 0xc8, 0x03, 0xc6,
+	0x85, 0xd0, 0xf9, 0xa5, 0x86, 0xc9, 0x04, 0x60, 0xe8, 0xad, 0x02, 0xb0,
+	0x45, 0x87, 0x29, 0x20, 0xf0, 0xf6, 0xa5, 0x87, 0x49, 0x20, 0x85, 0x87,
+	0x60,
+};
+
+// Where the parameters go: load and run addresses, little endian, the
+// number of 256 byte blocks, and the length of the last, 0 for 256.
+//
+static const int TURBO_START = 3;
+static const int TURBO_EXEC = 5;
+static const int TURBO_BLOCKS = 7;
+static const int TURBO_LAST = 8;
+
+
+// Makes the ATM for the loader that goes ahead of 'program' on a turbo
+// tape. It takes the program's name, so *RUN"NAME" works the same as
+// ever. False if the program would load over the loader, its workspace
+// or the stack.
+//
+inline bool makeTurboLoader(const BYTE* program, std::vector<BYTE>& loader)
+{
+	const ATMHEADER* atm = (const ATMHEADER*)program;
+	int start = atm->start;
+	int length = atm->length;
+	int end = TURBO_LOADADDR + (int)sizeof(TURBO_LOADER);
+
+	if (length == 0 || (start < end && start + length > TURBO_WORKSPACE))
+	{
+		return false;
+	}
+
+	loader.assign(sizeof(ATMHEADER) + sizeof(TURBO_LOADER), 0);
+
+	ATMHEADER* header = (ATMHEADER*)&loader[0];
+	memcpy(header->filename, atm->filename, sizeof(header->filename));
+	header->start = TURBO_LOADADDR;
+	header->exec = TURBO_LOADADDR;
+	header->length = sizeof(TURBO_LOADER);
+
+	BYTE* stub = &loader[sizeof(ATMHEADER)];
+	memcpy(stub, TURBO_LOADER, sizeof(TURBO_LOADER));
+	stub[TURBO_START] = (BYTE)(start & 0xff);
+	stub[TURBO_START + 1] = (BYTE)(start >> 8);
+	stub[TURBO_EXEC] = (BYTE)(atm->exec & 0xff);
+	stub[TURBO_EXEC + 1] = (BYTE)(atm->exec >> 8);
+	stub[TURBO_BLOCKS] = (BYTE)((length + 255) / 256);
+	stub[TURBO_LAST] = (BYTE)(length & 0xff);
+
+	return true;
+}
+
+#endif
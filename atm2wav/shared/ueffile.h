@@ -0,0 +1,223 @@
+#ifndef __ueffile_h
+#define __ueffile_h
+
+#include <istream>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+
+#include "gzip.h"
+#include "cuts.h"
+
+// UEF, the Acorn emulators' tape image, read back. There's no audio to
+//  decode, the bytes are there as they are in 0x0100 chunks. Carrier tone
+//  (0x0110, or 0x0111 with its dummy byte) is all that's needed besides,
+//  it's where the blocks start. Gaps (0x0112) and everything else that
+//  can be in a UEF don't matter to us.
+//
+// Needs shared/defines.h.
+
+
+class ueftape
+{
+public:
+	ueftape() :
+		m_pos(0)
+	{
+	}
+
+	// Reads the whole UEF, gzipped or not.
+	// Returns false with a reason in 'error' if the file's no good to us.
+	//
+	bool read(std::istream& in, const char*& error)
+	{
+		in.seekg(0, std::ios_base::end);
+		std::vector<BYTE> file(size_t(in.tellg()));
+		in.seekg(0);
+		if (!file.empty())
+		{
+			in.read((char*)&file[0], (std::streamsize)file.size());
+		}
+
+		if (file.size() >= 2 && file[0] == 0x1f && file[1] == 0x8b)
+		{
+			std::vector<BYTE> inflated;
+			if (!gunzip(&file[0], file.size(), inflated))
+			{
+				error = "UEF won't gunzip.";
+				return false;
+			}
+			file.swap(inflated);
+		}
+
+		if (!in || file.size() < 12 || memcmp(&file[0], "UEF File!", 10) != 0)
+		{
+			error = "Not a UEF file.";
+			return false;
+		}
+
+		m_bytes.clear();
+		m_tones.clear();
+		m_pos = 0;
+
+		// Chunks: 2 bytes of id, 4 of length, then the chunk.
+		//
+		for (size_t pos = 12; pos + 6 <= file.size(); )
+		{
+			int id = file[pos] | (file[pos + 1] << 8);
+			size_t length = file[pos + 2] | (file[pos + 3] << 8) | (file[pos + 4] << 16) | ((size_t)file[pos + 5] << 24);
+			pos += 6;
+
+			if (length > file.size() - pos)
+			{
+				error = "UEF chunk runs off the end.";
+				return false;
+			}
+
+			const BYTE* chunk = &file[0] + pos;
+			pos += length;
+
+			switch (id)
+			{
+			case 0x0100:
+				m_bytes.insert(m_bytes.end(), chunk, chunk + length);
+				break;
+
+			case 0x0110:
+			case 0x0111:
+				// One mark per run of tone, however many chunks it takes.
+				//
+				if (m_tones.empty() || m_tones.back() != m_bytes.size())
+				{
+					m_tones.push_back(m_bytes.size());
+				}
+				break;
+			}
+		}
+		return true;
+	}
+
+	// Reads a byte, tone or no tone.
+	//
+	bool getByte(BYTE& byte)
+	{
+		if (m_pos >= m_bytes.size())
+		{
+			return false;
+		}
+		byte = m_bytes[m_pos++];
+		m_check += byte;
+		return true;
+	}
+
+	// On to the next carrier tone. There's a short one between a block's
+	//  header and its data, which getByte has already stepped over by the
+	//  time we're looking for the next block. A UEF with no tone in it at
+	//  all is just read straight through.
+	//
+	bool findLeader(void)
+	{
+		std::vector<size_t>::const_iterator tone = std::lower_bound(m_tones.begin(), m_tones.end(), m_pos);
+		if (tone != m_tones.end())
+		{
+			m_pos = *tone;
+		}
+		return m_pos < m_bytes.size();
+	}
+
+	bool atEnd(void)
+	{
+		return !findLeader();
+	}
+
+	// Reads a whole named block, as cuts does off a WAV, with the same
+	//  errors. A first 4 bytes that aren't a '****' preamble are left in
+	//  block.preamble with error NULL, that's an unnamed file.
+	//
+	bool readBlock(tapeblock& block, const char*& error)
+	{
+		memset(&block, 0, sizeof(block));
+
+		if (!findLeader())
+		{
+			error = "Didn't find leader tone.";
+			return false;
+		}
+
+		block.leaderEnd = m_pos;
+
+		int i;
+		m_check = 0;
+
+		for (i = 0; i < 4; ++i)
+		{
+			if (!getByte(block.preamble[i]))
+			{
+				error = "Failed reading preamble.";
+				return false;
+			}
+		}
+
+		if (!block.isNamed())
+		{
+			error = NULL;
+			return false;
+		}
+
+		i = -1;
+		do
+		{
+			if (!getByte(block.name[++i]))
+			{
+				error = "Failed reading filename.";
+				return false;
+			}
+		}
+		while(block.name[i] != 0x0d && i != 13);
+		block.name[i] = 0x0;
+
+		BYTE* headBytes = (BYTE*)&block.header;
+		for (i = 0; i < 8; ++i)
+		{
+			if (!getByte(headBytes[i]))
+			{
+				error = "Failed reading header.";
+				return false;
+			}
+		}
+
+		for (i = 0; i < block.length(); ++i)
+		{
+			if (!getByte(block.data[i]))
+			{
+				error = "Failed reading data block.";
+				return false;
+			}
+		}
+
+		BYTE expected = m_check;
+		if (!getByte(block.sum))
+		{
+			error = "Failed reading checksum byte.";
+			return false;
+		}
+
+		if (block.sum != expected)
+		{
+			error = "SUM";
+			return false;
+		}
+
+		return true;
+	}
+
+	// The tape's bytes and the offsets into them where tone was.
+	//
+	std::vector<BYTE> m_bytes;
+	std::vector<size_t> m_tones;
+
+	size_t m_pos;
+	BYTE m_check;
+};
+
+#endif
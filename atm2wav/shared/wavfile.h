@@ -0,0 +1,245 @@
+#ifndef __wavfile_h
+#define __wavfile_h
+
+#include <istream>
+#include <vector>
+#include <string.h>
+
+#include "tapesource.h"
+
+// Needs shared/defines.h.
+
+
+// Set structure packing to byte boundaries
+// ... else strange things are happening under vs2005.
+//
+// This may well be MS specific, adjust to taste.
+//
+#pragma pack(push, 1)
+
+typedef struct
+{
+	char chunkid[4];
+	DWORD chunkSize;
+	char format[4];
+}
+RIFFHEADER;
+
+typedef struct
+{
+	char chunkid[4];
+	DWORD chunkSize;
+	WORD foramtTag;
+	WORD channels;
+	DWORD samplesPerSec;
+	DWORD avgBytesPerSec;
+	WORD blockAlign;
+	WORD bitsPerSample;
+	// BYTE extradata [chunkSize-16]
+}
+FMTHEADER;
+
+typedef struct
+{
+	char chunkid[4];
+	DWORD chunkSize;
+}
+DATACHUNK;
+
+// Restore default structure packing
+//
+#pragma pack(pop)
+
+
+// Reads the headers of a 16 bit mono WAV, leaving 'in' at the first sample
+//  and the number of samples to come in 'length'.
+// Anything between the fmt and data chunks gets skipped. RF64 is fine
+//  too, the real data size is in its ds64 chunk.
+// Returns false with a reason in 'error' if the file's no good to us.
+//
+inline bool readwavheader(std::istream& in, int& sampleRate, size_t& length, const char*& error)
+{
+	RIFFHEADER riffhdr;
+	in.read((char*)&riffhdr, sizeof(RIFFHEADER));
+	bool rf64 = memcmp(riffhdr.chunkid, "RF64", 4) == 0;
+	if (!in || (memcmp(riffhdr.chunkid, "RIFF", 4) != 0 && !rf64) || memcmp(riffhdr.format, "WAVE", 4) != 0)
+	{
+		error = "Not a WAV file.";
+		return false;
+	}
+
+	// The RIFF size, then the data size, then the rest.
+	//
+	unsigned long long dataSize = 0;
+	if (rf64)
+	{
+		DATACHUNK ds64;
+		unsigned long long sizes[2];
+		in.read((char*)&ds64, sizeof(DATACHUNK));
+		in.read((char*)sizes, sizeof(sizes));
+		if (!in || memcmp(ds64.chunkid, "ds64", 4) != 0 || ds64.chunkSize < sizeof(sizes))
+		{
+			error = "Not a WAV file.";
+			return false;
+		}
+		dataSize = sizes[1];
+		in.seekg(((ds64.chunkSize + 1) & ~1) - sizeof(sizes), std::ios_base::cur);
+	}
+
+	FMTHEADER fmthdr;
+	in.read((char*)&fmthdr, sizeof(FMTHEADER));
+	if (!in || memcmp(fmthdr.chunkid, "fmt ", 4) != 0)
+	{
+		error = "Not a WAV file.";
+		return false;
+	}
+
+	if (fmthdr.bitsPerSample != 16 || fmthdr.channels != 1)
+	{
+		error = "Wav should be mono, 16 bit please.";
+		return false;
+	}
+
+	in.seekg(fmthdr.chunkSize - 16, std::ios_base::cur);
+
+	DATACHUNK datachk;
+	for (;;)
+	{
+		in.read((char*)&datachk, sizeof(DATACHUNK));
+		if (!in)
+		{
+			error = "No data in WAV.";
+			return false;
+		}
+		if (memcmp(datachk.chunkid, "data", 4) == 0)
+		{
+			break;
+		}
+
+		// Chunks are word aligned.
+		//
+		in.seekg((datachk.chunkSize + 1) & ~1, std::ios_base::cur);
+	}
+
+	sampleRate = fmthdr.samplesPerSec;
+	length = size_t((rf64 && datachk.chunkSize == 0xffffffff ? dataSize : datachk.chunkSize) / sizeof(short));
+	return true;
+}
+
+
+// Reads a 16 bit mono WAV into memory.
+//
+inline bool readwav(std::istream& in, std::vector<short>& samples, int& sampleRate, const char*& error)
+{
+	size_t length;
+	if (!readwavheader(in, sampleRate, length, error))
+	{
+		return false;
+	}
+
+	samples.resize(length);
+	if (!samples.empty())
+	{
+		in.read((char*)&samples.front(), (std::streamsize)samples.size() * sizeof(short));
+		samples.resize(size_t(in.gcount()) / sizeof(short));
+	}
+
+	return true;
+}
+
+
+// A WAV read a buffer at a time rather than all at once, for tapes too
+//  long to want in memory. Construct it once readwavheader is done with
+//  the stream.
+//
+// Backing up a little way is cheap, the decoder does that after looking
+//  ahead, so the last part of what's been read is kept on hand. Going
+//  further back, or skipping forward, seeks the file.
+//
+class wavtape : public tapesource
+{
+public:
+	wavtape(std::istream& in, size_t length) :
+		m_in(in),
+		m_start(in.tellg()),
+		m_length(length),
+		m_base(0),
+		m_count(0),
+		m_buffer(BUFFERSAMPLES)
+	{
+	}
+
+	virtual size_t fetch(size_t pos, const short*& samples, size_t want = 1)
+	{
+		samples = NULL;
+		if (pos >= m_length)
+		{
+			return 0;
+		}
+
+		size_t avail = pos >= m_base && pos < m_base + m_count ? m_base + m_count - pos : 0;
+		if (avail < want && m_base + m_count < m_length)
+		{
+			fill(pos);
+			avail = pos >= m_base && pos < m_base + m_count ? m_base + m_count - pos : 0;
+		}
+
+		if (avail)
+		{
+			samples = &m_buffer[pos - m_base];
+		}
+		return avail;
+	}
+
+private:
+	// Reads as much as will fit from 'pos' on, keeping what's already
+	//  on hand from a way before it.
+	//
+	void fill(size_t pos)
+	{
+		size_t keepFrom = pos > KEEPSAMPLES ? pos - KEEPSAMPLES : 0;
+
+		if (pos < m_base || keepFrom >= m_base + m_count)
+		{
+			m_in.clear();
+			m_in.seekg(m_start + std::streamoff(keepFrom * sizeof(short)));
+			m_base = keepFrom;
+			m_count = 0;
+		}
+		else if (keepFrom > m_base)
+		{
+			m_count -= keepFrom - m_base;
+			memmove(&m_buffer[0], &m_buffer[keepFrom - m_base], m_count * sizeof(short));
+			m_base = keepFrom;
+		}
+
+		size_t n = m_buffer.size() - m_count;
+		if (n > m_length - (m_base + m_count))
+		{
+			n = m_length - (m_base + m_count);
+		}
+
+		m_in.read((char*)&m_buffer[m_count], (std::streamsize)(n * sizeof(short)));
+		size_t got = size_t(m_in.gcount()) / sizeof(short);
+		m_count += got;
+
+		// A truncated file ends where the data does.
+		//
+		if (got < n)
+		{
+			m_length = m_base + m_count;
+		}
+	}
+
+	static const size_t BUFFERSAMPLES = 1 << 20;
+	static const size_t KEEPSAMPLES = 1 << 18;
+
+	std::istream& m_in;
+	std::streampos m_start;
+	size_t m_length;
+	size_t m_base;
+	size_t m_count;
+	std::vector<short> m_buffer;
+};
+
+#endif
@@ -0,0 +1,450 @@
+/*
+
+cutsbench
+By Charlie Robson
+
+charlie_robson@hotmail.com
+arduinonut.blogspot.com
+
+Times the cuts tape decoder from wav2atm.
+
+Runs findLeader, getByte and a whole tape decode over a fixed set of synthetic
+tapes, plus any real captures named on the command line, with and without the
+tone pre-scan. Each test is repeated and the best and median times reported
+as one JSON object per line, so runs can be diffed and graphed.
+
+Synthetic tapes are made here rather than loaded so the corpus is the same
+on every machine:
+
+clean   20K program, standard 300 baud, nothing else on the tape.
+padded  The same with a minute of hiss before it and 30 seconds of chatter
+        either side, like a typical archive transfer.
+turbo   The same program at 4 times the speed, 2 cycles of 2400hz for a 0
+        and 4 cycles of 4800hz for a 1.
+
+*/
+
+#define VERSION "1.0.0"
+
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include <math.h>
+
+#include "shared\argcrack.h"
+#include "shared\bench.h"
+#include "shared\defines.h"
+#include "shared\wavfile.h"
+#include "shared\cuts.h"
+#include "shared\json.h"
+
+
+
+// Makes test tapes. Square waves, the same as atm2wav puts out, but with
+// whatever tones and cycles per bit you care for.
+//
+class tapesynth
+{
+public:
+	tapesynth(std::vector<short>& tape, int sampleRate) :
+		_tape(tape),
+		_sampleRate(sampleRate),
+		_time(0),
+		_seed(12345)
+	{
+	}
+
+	// Cycles of one tone. Timing is kept in seconds from the start of the
+	// tape rather than in whole samples so that tones which don't divide
+	// the sample rate don't drift.
+	//
+	void tone(int hz, int cycles)
+	{
+		double start = _time;
+		_time += double(cycles) / hz;
+
+		size_t first = size_t(start * _sampleRate + 0.5);
+		size_t last = size_t(_time * _sampleRate + 0.5);
+		for (size_t i = first; i < last; ++i)
+		{
+			double phase = (double(i) / _sampleRate - start) * hz;
+			_tape.push_back(phase - floor(phase) < 0.5 ? -16384 : 16384);
+		}
+	}
+
+	void bit(bool one)
+	{
+		if (one)
+		{
+			tone(_hiHz, _oneCycles);
+		}
+		else
+		{
+			tone(_loHz, _zeroCycles);
+		}
+	}
+
+	void byte(BYTE value)
+	{
+		bit(false);
+		for (int i = 0; i < 8; ++i)
+		{
+			bit((value & (1 << i)) != 0);
+		}
+		bit(true);
+
+		_checksum += value;
+	}
+
+	void leader(int ms)
+	{
+		tone(_hiHz, (ms * _hiHz) / 1000);
+	}
+
+	// Low level noise, and a wobbly 200-400hz tone standing in for speech.
+	//
+	void hiss(int ms)
+	{
+		int n = int(((long long)ms * _sampleRate) / 1000);
+		for (int i = 0; i < n; ++i)
+		{
+			_tape.push_back(short(int(random() % 200) - 100));
+		}
+		_time += double(n) / _sampleRate;
+	}
+
+	void chatter(int ms)
+	{
+		int n = int(((long long)ms * _sampleRate) / 1000);
+		for (int i = 0; i < n; ++i)
+		{
+			double hz = 300.0 + 100.0 * sin(i * 0.0005);
+			_tape.push_back(short(8000.0 * sin(i * hz * 6.283185307 / _sampleRate)) + short(int(random() % 600) - 300));
+		}
+		_time += double(n) / _sampleRate;
+	}
+
+	// A named file, laid out just as atm2wav does it.
+	//
+	void named(const char* name, const std::vector<BYTE>& data, int start)
+	{
+		int length = int(data.size());
+		for (int offs = 0, blockNum = 0; offs < length; offs += 256, ++blockNum)
+		{
+			int blockLen = std::min(256, length - offs);
+			bool last = offs + 256 >= length;
+
+			BYTE flags = 0x40;
+			flags |= last ? 0 : 0x80;
+			flags |= offs ? 0x20 : 0;
+
+			leader(offs ? 1000 : 4550);
+
+			_checksum = 0;
+			byte('*');
+			byte('*');
+			byte('*');
+			byte('*');
+			for (const char* p = name; *p; ++p)
+			{
+				byte(*p);
+			}
+			byte(0x0d);
+
+			byte(flags);
+			byte(0);
+			byte((BYTE)(blockNum));
+			byte((BYTE)(blockLen - 1));
+			byte((BYTE)(start >> 8));
+			byte((BYTE)(start));
+			byte((BYTE)((start + offs) >> 8));
+			byte((BYTE)(start + offs));
+
+			leader(1000);
+
+			for (int i = 0; i < blockLen; ++i)
+			{
+				byte(data[offs + i]);
+			}
+			byte(_checksum);
+		}
+		leader(200);
+	}
+
+	void setBitModel(int hiHz, int loHz, int oneCycles, int zeroCycles)
+	{
+		_hiHz = hiHz;
+		_loHz = loHz;
+		_oneCycles = oneCycles;
+		_zeroCycles = zeroCycles;
+	}
+
+	unsigned int random(void)
+	{
+		_seed = _seed * 1103515245 + 12345;
+		return (_seed >> 16) & 0x7fff;
+	}
+
+private:
+	std::vector<short>& _tape;
+	int _sampleRate;
+	double _time;
+	unsigned int _seed;
+
+	int _hiHz, _loHz, _oneCycles, _zeroCycles;
+	BYTE _checksum;
+};
+
+
+
+struct testtape
+{
+	std::string name;
+	std::vector<short> samples;
+	int sampleRate;
+};
+
+
+
+void report(std::ostream& out, const testtape& tape, bool scan, const char* bench, const timing& t, size_t samples, const char* items)
+{
+	double secs = t.best > 0 ? t.best : 1e-9;
+
+	out << "{\"tape\":" << jsonString(tape.name)
+		<< ",\"prescan\":" << (scan ? "true" : "false")
+		<< ",\"bench\":\"" << bench << "\""
+		<< ",\"samples\":" << samples
+		<< ",\"best_s\":" << t.best
+		<< ",\"median_s\":" << t.median
+		<< ",\"samples_per_sec\":" << samples / secs
+		<< ",\"mb_per_sec\":" << (samples * sizeof(short)) / secs / 1e6
+		<< ",\"" << items << "\":" << t.items
+		<< ",\"" << items << "_per_sec\":" << t.items / secs
+		<< ",\"cycles_per_sample\":" << (samples ? double(t.bestCycles) / samples : 0.0)
+		<< "}" << std::endl;
+}
+
+
+void setup(cuts& knife, const testtape& tape, bool scan)
+{
+	if (scan)
+	{
+		knife.prescan(tape.sampleRate / 100);
+	}
+}
+
+
+void benchTape(std::ostream& out, testtape& tape, bool scan, int trials)
+{
+	// Pre-scan on its own.
+	//
+	if (scan)
+	{
+		timing t = runTrials([&]() -> long long
+		{
+			memorytape source(tape.samples);
+			cuts knife(source, tape.sampleRate);
+			knife.prescan(tape.sampleRate / 100);
+			return (long long)knife.m_regions.size();
+		}, trials);
+		report(out, tape, scan, "prescan", t, tape.samples.size(), "regions");
+	}
+
+	// Every stretch of tone on the tape, the leader ahead of each block
+	// and the gap after its header. findLeader's happy after 1024 half
+	// cycles and goes again on the rest of a long one, so a tone only
+	// counts once it's run out into a start bit.
+	//
+	timing t = runTrials([&]() -> long long
+	{
+		memorytape source(tape.samples);
+		cuts knife(source, tape.sampleRate);
+		setup(knife, tape, scan);
+
+		long long tones = 0;
+		while (knife.findLeader())
+		{
+			if (knife.findStartBit())
+			{
+				++tones;
+			}
+		}
+		return tones;
+	}, trials);
+	report(out, tape, scan, "findLeader", t, tape.samples.size(), "tones");
+
+	// Every byte, from the first start bit to the end of the tape. The
+	// micro-leader handling in getByte walks over the gaps for us.
+	//
+	size_t byteSamples = 0;
+	t = runTrials([&]() -> long long
+	{
+		memorytape source(tape.samples);
+		cuts knife(source, tape.sampleRate);
+		setup(knife, tape, scan);
+
+		long long bytes = 0;
+		if (knife.findLeader() && knife.findStartBit())
+		{
+			knife.calibrate();
+
+			size_t start = knife.tell();
+			BYTE byte;
+			while (knife.getByte(byte))
+			{
+				++bytes;
+			}
+			byteSamples = knife.tell() - start;
+		}
+		return bytes;
+	}, trials);
+	report(out, tape, scan, "getByte", t, byteSamples, "bytes");
+
+	// The lot, as wav2atm does it.
+	//
+	t = runTrials([&]() -> long long
+	{
+		memorytape source(tape.samples);
+		cuts knife(source, tape.sampleRate);
+		setup(knife, tape, scan);
+
+		long long blocks = 0;
+		tapeblock block;
+		const char* error;
+		while (knife.readBlock(block, error))
+		{
+			++blocks;
+			if (block.isLast())
+			{
+				break;
+			}
+		}
+		return blocks;
+	}, trials);
+	report(out, tape, scan, "decode", t, tape.samples.size(), "blocks");
+}
+
+
+
+int main(int argc, char** argv)
+{
+	argcrack param(argc, argv);
+
+	if (param.ispresent("/?") || param.ispresent("-?") || param.ispresent("?"))
+	{
+		std::cout << "CUTSBENCH V" << VERSION << std::endl;
+		std::cout << std::endl;
+		std::cout << "Times the tape decoder over synthetic tapes and any WAVs given." << std::endl;
+		std::cout << "Results are written one JSON object per line." << std::endl;
+		std::cout << std::endl;
+		std::cout << "Usage: cutsbench [wavfile ...] [options]" << std::endl;
+		std::cout << std::endl;
+		std::cout << "Options:" << std::endl;
+		std::cout << std::endl;
+		std::cout << "out=     Results file. Optional, defaults to the console." << std::endl;
+		std::cout << "trials=  Times to repeat each test. Default 5." << std::endl;
+		std::cout << "cpu=     Core to pin to. Default 0." << std::endl;
+		std::cout << "nosynth  Leave out the synthetic tapes." << std::endl;
+		return 1;
+	}
+
+	int trials = 5;
+	param.getint("trials", trials);
+	if (trials < 1)
+	{
+		trials = 1;
+	}
+
+	int cpu = 0;
+	param.getint("cpu", cpu);
+	if (!pinToCpu(cpu))
+	{
+		std::cerr << "Couldn't pin to cpu " << cpu << ", timings may wander." << std::endl;
+	}
+
+	std::vector<testtape> corpus;
+
+	if (!param.ispresent("nosynth"))
+	{
+		// A 20K program's worth of something that isn't all the same byte.
+		//
+		std::vector<BYTE> program(20 * 1024);
+		for (size_t i = 0; i < program.size(); ++i)
+		{
+			program[i] = (BYTE)((i * 7) ^ (i >> 3));
+		}
+
+		testtape clean;
+		clean.name = "clean";
+		clean.sampleRate = 44100;
+		tapesynth cleanSynth(clean.samples, clean.sampleRate);
+		cleanSynth.setBitModel(2400, 1200, 8, 4);
+		cleanSynth.named("BENCH", program, 0x2900);
+		corpus.push_back(clean);
+
+		testtape padded;
+		padded.name = "padded";
+		padded.sampleRate = 44100;
+		tapesynth paddedSynth(padded.samples, padded.sampleRate);
+		paddedSynth.setBitModel(2400, 1200, 8, 4);
+		paddedSynth.hiss(60000);
+		paddedSynth.chatter(30000);
+		paddedSynth.named("BENCH", program, 0x2900);
+		paddedSynth.chatter(30000);
+		corpus.push_back(padded);
+
+		testtape turbo;
+		turbo.name = "turbo";
+		turbo.sampleRate = 44100;
+		tapesynth turboSynth(turbo.samples, turbo.sampleRate);
+		turboSynth.setBitModel(4800, 2400, 4, 2);
+		turboSynth.named("BENCH", program, 0x2900);
+		corpus.push_back(turbo);
+	}
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strchr(argv[i], '=') || _strnicmp(argv[i], "nosynth", 7) == 0)
+		{
+			continue;
+		}
+
+		std::ifstream in(argv[i], std::ios_base::in | std::ios_base::binary);
+		testtape real;
+		real.name = argv[i];
+
+		const char* error;
+		if (!in.is_open() || !readwav(in, real.samples, real.sampleRate, error))
+		{
+			std::cerr << "Skipping " << argv[i] << ", can't read it." << std::endl;
+			continue;
+		}
+		corpus.push_back(real);
+	}
+
+	std::ofstream outFile;
+	std::string outName;
+	if (param.getstring("out", outName))
+	{
+		outFile.open(outName.c_str(), std::ios_base::out);
+		if (!outFile.is_open())
+		{
+			std::cout << "Invalid output file " << outName.c_str() << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& out = outFile.is_open() ? outFile : std::cout;
+
+	for (size_t i = 0; i < corpus.size(); ++i)
+	{
+		benchTape(out, corpus[i], true, trials);
+		benchTape(out, corpus[i], false, trials);
+	}
+
+	return 0;
+}
@@ -0,0 +1,444 @@
+/*
+
+freqbench
+By Charlie Robson
+
+charlie_robson@hotmail.com
+arduinonut.blogspot.com
+
+Times the freqout tape encoder from atm2wav.
+
+Renders a fixed set of ATMs, plus any named on the command line, named and
+unnamed, at 8 and 16 bit. Each is rendered into a sink that throws the
+bytes away, which times the waveform generator and output buffering on their
+own, and into a real file. Each test is repeated and the best and median
+times reported as one JSON object per line, like cutsbench.
+
+A frame is a byte on tape with its start and stop bits, 10 bits' worth.
+ns_per_frame is the time for the whole tape over the number of frames it
+comes to, leaders included, so it's comparable whatever the mix of tone and
+data.
+
+The ATMs are made here rather than loaded so the corpus is the same on every
+machine:
+
+basic1k   A short BASIC program.
+basic6k   A longer one.
+image20k  20K of machine code and data.
+image40k  40K, about all an Atom has room for.
+
+To look at one case under a profiler, pick it with only= and turn trials up,
+e.g. freqbench only=image40k/named/16/render trials=500
+
+*/
+
+#define VERSION "1.0.0"
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+#include <stdio.h>
+#include <ctype.h>
+
+#include "shared\argcrack.h"
+#include "shared\bench.h"
+#include "shared\defines.h"
+#include "shared\atmheader.h"
+#include "shared\freqout.h"
+#include "shared\json.h"
+
+
+
+// Somewhere to write that isn't anywhere, so only the encoder gets timed.
+//
+class nullbuf : public std::streambuf
+{
+protected:
+	virtual std::streamsize xsputn(const char*, std::streamsize count)
+	{
+		return count;
+	}
+
+	virtual int overflow(int c)
+	{
+		return c == EOF ? 0 : c;
+	}
+};
+
+
+
+struct benchatm
+{
+	std::string name;
+	std::vector<BYTE> image;
+};
+
+
+// An ATM: header then data.
+//
+benchatm makeAtm(const char* name, int start, int exec, const std::vector<BYTE>& data)
+{
+	benchatm atm;
+	atm.name = name;
+	atm.image.resize(sizeof(ATMHEADER) + data.size());
+
+	ATMHEADER* header = (ATMHEADER*)&atm.image[0];
+	memset(header, 0, sizeof(ATMHEADER));
+	for (int i = 0; i < 13 && name[i]; ++i)
+	{
+		header->filename[i] = (char)toupper(name[i]);
+	}
+	header->start = (WORD)start;
+	header->exec = (WORD)exec;
+	header->length = (WORD)data.size();
+
+	std::copy(data.begin(), data.end(), atm.image.begin() + sizeof(ATMHEADER));
+	return atm;
+}
+
+
+// BASIC as the Atom keeps it: each line a CR, the line number high byte
+// first, then the text. Ends with CR FF.
+//
+std::vector<BYTE> makeBasic(size_t size)
+{
+	static const char* lines[] =
+	{
+		"P.\"SCORE \"S;\" LIVES \"L",
+		"IF A>B THEN G.200",
+		"F.I=1 TO 32;?(#8000+I)=I;N.",
+		"X=X+DX;Y=Y+DY;PLOT 13,X,Y",
+		"REM MOVE THE ALIENS DOWN A ROW",
+		"DO A=A+1;UNTIL ?#B001&8=0"
+	};
+
+	std::vector<BYTE> program;
+	for (int line = 10; program.size() + 40 < size; line += 10)
+	{
+		const char* text = lines[(line / 10) % 6];
+		program.push_back(0x0d);
+		program.push_back((BYTE)(line >> 8));
+		program.push_back((BYTE)line);
+		program.insert(program.end(), text, text + strlen(text));
+	}
+	program.push_back(0x0d);
+	program.push_back(0xff);
+	return program;
+}
+
+
+// Something that looks more like code than the same byte over and over.
+//
+std::vector<BYTE> makeImage(size_t size)
+{
+	std::vector<BYTE> image(size);
+	for (size_t i = 0; i < image.size(); ++i)
+	{
+		image[i] = (BYTE)((i * 7) ^ (i >> 3));
+	}
+	return image;
+}
+
+
+
+// Renders the ATM the way atm2wav does, header and all. Returns the
+// number of samples.
+//
+long long render(std::ostream& out, benchatm& atm, bool unnamed, int bitsPerSample, int sampleRate)
+{
+	std::unique_ptr<freqout> fo(newFreqout(&atm.image[0], out, bitsPerSample, sampleRate));
+
+	long long samples = fo->tapeSamples(TIMING_STANDARD, unnamed);
+	fo->createWaveFile(samples);
+	if (unnamed)
+	{
+		fo->writeunnamed(TIMING_STANDARD);
+	}
+	else
+	{
+		fo->write(TIMING_STANDARD);
+	}
+	fo->finaliseWaveFile();
+
+	return fo->_writtenSampleCount;
+}
+
+
+// Frames of tape the ATM comes to. See the top.
+//
+long long tapeFrames(benchatm& atm, bool unnamed, int sampleRate)
+{
+	std::ostringstream unused;
+	freqoutT<pcm16> fo(&atm.image[0], unused, sampleRate);
+
+	if (unnamed)
+	{
+		ATMHEADER* header = (ATMHEADER*)&atm.image[0];
+		return (fo.toneBits(TIMING_STANDARD.lead) + (4 + header->length) * 10) / 10;
+	}
+
+	std::vector<freqout::blockplan> blocks;
+	return fo.planBlocks(TIMING_STANDARD, blocks) / 10;
+}
+
+
+void report(std::ostream& out, const std::string& test, const benchatm* atm, bool unnamed, int bitsPerSample, int sampleRate, const char* bench, const timing& t, long long frames)
+{
+	double secs = t.best > 0 ? t.best : 1e-9;
+	long long samples = t.items;
+	long long bytes = samples * (bitsPerSample / 8);
+
+	out << "{\"test\":" << jsonString(test);
+	if (atm)
+	{
+		out << ",\"atm\":" << jsonString(atm->name)
+			<< ",\"atm_bytes\":" << atm->image.size() - sizeof(ATMHEADER)
+			<< ",\"mode\":\"" << (unnamed ? "unnamed" : "named") << "\"";
+	}
+	out << ",\"bits\":" << bitsPerSample
+		<< ",\"rate\":" << sampleRate
+		<< ",\"bench\":\"" << bench << "\""
+		<< ",\"best_s\":" << t.best
+		<< ",\"median_s\":" << t.median;
+	if (samples)
+	{
+		out << ",\"samples\":" << samples
+			<< ",\"samples_per_sec\":" << samples / secs
+			<< ",\"mb_per_sec\":" << bytes / secs / 1e6
+			<< ",\"cycles_per_sample\":" << double(t.bestCycles) / samples;
+	}
+	if (frames)
+	{
+		out << ",\"frames\":" << frames
+			<< ",\"ns_per_frame\":" << secs * 1e9 / frames;
+	}
+	out << "}" << std::endl;
+}
+
+
+// Is 'test' one we're doing? All of them unless only= says otherwise, in
+// which case anything with that in its name.
+//
+bool wanted(const std::string& test, const std::string& only)
+{
+	return only.empty() || test.find(only) != std::string::npos;
+}
+
+
+
+int main(int argc, char** argv)
+{
+	argcrack param(argc, argv);
+
+	if (param.ispresent("/?") || param.ispresent("-?") || param.ispresent("?"))
+	{
+		std::cout << "FREQBENCH V" << VERSION << std::endl;
+		std::cout << std::endl;
+		std::cout << "Times the tape encoder over a fixed set of ATMs and any more given." << std::endl;
+		std::cout << "Results are written one JSON object per line." << std::endl;
+		std::cout << std::endl;
+		std::cout << "Usage: freqbench [atmfile ...] [options]" << std::endl;
+		std::cout << std::endl;
+		std::cout << "Options:" << std::endl;
+		std::cout << std::endl;
+		std::cout << "out=     Results file. Optional, defaults to the console." << std::endl;
+		std::cout << "trials=  Times to repeat each test. Default 5." << std::endl;
+		std::cout << "cpu=     Core to pin to. Default 0." << std::endl;
+		std::cout << "rate=    Sample rate. Default 44100." << std::endl;
+		std::cout << "tmp=     File to write for the file I/O tests. Default freqbench.tmp." << std::endl;
+		std::cout << "only=    Just the tests with this in their name, as atm/mode/bits/bench." << std::endl;
+		std::cout << "nofile   Leave out the file I/O tests." << std::endl;
+		return 1;
+	}
+
+	int trials = 5;
+	param.getint("trials", trials);
+	if (trials < 1)
+	{
+		trials = 1;
+	}
+
+	int cpu = 0;
+	param.getint("cpu", cpu);
+	if (!pinToCpu(cpu))
+	{
+		std::cerr << "Couldn't pin to cpu " << cpu << ", timings may wander." << std::endl;
+	}
+
+	int sampleRate = 44100;
+	param.getint("rate", sampleRate);
+	if (sampleRate < 8000 || sampleRate > 192000)
+	{
+		std::cout << "Sample rate should be 8000 to 192000hz." << std::endl;
+		return 1;
+	}
+
+	std::string tmpName = "freqbench.tmp";
+	param.getstring("tmp", tmpName);
+
+	std::string only;
+	param.getstring("only", only);
+
+	bool fileTests = !param.ispresent("nofile");
+
+	std::vector<benchatm> corpus;
+	corpus.push_back(makeAtm("basic1k", 0x2900, 0xc2b2, makeBasic(1024)));
+	corpus.push_back(makeAtm("basic6k", 0x2900, 0xc2b2, makeBasic(6 * 1024)));
+	corpus.push_back(makeAtm("image20k", 0x2900, 0x2900, makeImage(20 * 1024)));
+	corpus.push_back(makeAtm("image40k", 0x0400, 0x0400, makeImage(40 * 1024)));
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strchr(argv[i], '=') || _strnicmp(argv[i], "nofile", 6) == 0)
+		{
+			continue;
+		}
+
+		std::ifstream in(argv[i], std::ios_base::in | std::ios_base::binary);
+		benchatm real;
+		real.name = argv[i];
+		real.image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+		if (!in.is_open() || real.image.size() < sizeof(ATMHEADER) ||
+			real.image.size() < sizeof(ATMHEADER) + ((ATMHEADER*)&real.image[0])->length)
+		{
+			std::cerr << "Skipping " << argv[i] << ", can't read it." << std::endl;
+			continue;
+		}
+		corpus.push_back(real);
+	}
+
+	std::ofstream outFile;
+	std::string outName;
+	if (param.getstring("out", outName))
+	{
+		outFile.open(outName.c_str(), std::ios_base::out);
+		if (!outFile.is_open())
+		{
+			std::cout << "Invalid output file " << outName.c_str() << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& out = outFile.is_open() ? outFile : std::cout;
+
+	nullbuf nothing;
+	std::ostream nowhere(&nothing);
+
+	static const int bitsPerSample[2] = { 8, 16 };
+
+	// Making an encoder, which every run pays for up front.
+	//
+	for (int b = 0; b < 2; ++b)
+	{
+		std::string test = "setup/" + std::to_string(bitsPerSample[b]);
+		if (!wanted(test, only))
+		{
+			continue;
+		}
+
+		timing t = runTrials([&]() -> long long
+		{
+			std::unique_ptr<freqout> fo(newFreqout(NULL, nowhere, bitsPerSample[b], sampleRate));
+			return 0;
+		}, trials);
+		report(out, test, NULL, false, bitsPerSample[b], sampleRate, "setup", t, 0);
+	}
+
+	for (size_t i = 0; i < corpus.size(); ++i)
+	{
+		for (int mode = 0; mode < 2; ++mode)
+		{
+			bool unnamed = mode == 1;
+			long long frames = tapeFrames(corpus[i], unnamed, sampleRate);
+
+			for (int b = 0; b < 2; ++b)
+			{
+				int bits = bitsPerSample[b];
+				std::string test = corpus[i].name + (unnamed ? "/unnamed/" : "/named/") + std::to_string(bits);
+
+				// Encoder and buffering only.
+				//
+				if (wanted(test + "/render", only))
+				{
+					timing t = runTrials([&]() -> long long
+					{
+						return render(nowhere, corpus[i], unnamed, bits, sampleRate);
+					}, trials);
+					report(out, test + "/render", &corpus[i], unnamed, bits, sampleRate, "render", t, frames);
+				}
+
+				// And the file it's all for.
+				//
+				if (fileTests && wanted(test + "/file", only))
+				{
+					bool ok = true;
+					timing t = runTrials([&]() -> long long
+					{
+						std::ofstream file(tmpName.c_str(), std::ios_base::out | std::ios_base::binary);
+						long long samples = render(file, corpus[i], unnamed, bits, sampleRate);
+						file.close();
+						ok = ok && !file.fail();
+						return samples;
+					}, trials);
+
+					if (!ok)
+					{
+						std::cerr << "Couldn't write " << tmpName.c_str() << "." << std::endl;
+						return 1;
+					}
+					report(out, test + "/file", &corpus[i], unnamed, bits, sampleRate, "file", t, frames);
+				}
+			}
+		}
+	}
+
+	// Everything on one tape with gaps between, like an atm2wav @list.
+	//
+	for (int b = 0; b < 2; ++b)
+	{
+		int bits = bitsPerSample[b];
+		std::string test = "compilation/" + std::to_string(bits) + "/render";
+		if (!wanted(test, only))
+		{
+			continue;
+		}
+
+		long long frames = 0;
+		for (size_t i = 0; i < corpus.size(); ++i)
+		{
+			frames += tapeFrames(corpus[i], false, sampleRate);
+		}
+
+		timing t = runTrials([&]() -> long long
+		{
+			std::unique_ptr<freqout> fo(newFreqout(NULL, nowhere, bits, sampleRate));
+			fo->createWaveFile();
+			for (size_t i = 0; i < corpus.size(); ++i)
+			{
+				fo->_rawData = &corpus[i].image[0];
+				fo->write(TIMING_STANDARD);
+				if (i + 1 < corpus.size())
+				{
+					fo->outGap(2000);
+				}
+			}
+			fo->flush();
+			return fo->_writtenSampleCount;
+		}, trials);
+		report(out, test, NULL, false, bits, sampleRate, "compilation", t, frames);
+	}
+
+	if (fileTests)
+	{
+		remove(tmpName.c_str());
+	}
+
+	return 0;
+}
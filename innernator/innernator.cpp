@@ -46,10 +46,10 @@ P.S. look out for the special bonus ninth cycle at the end of a byte's stop bit!
 
 #include <math.h>
 
+#include "shared\defines.h"
+#include "shared\cswfile.h"
+#include "shared\flacfile.h"
 
-typedef unsigned char BYTE;
-typedef unsigned short WORD;
-typedef unsigned long DWORD;
 
 #define _BV(x) (1<<(x))
 #define SGN(x) ((x)<0?-1:1)
@@ -135,9 +135,11 @@ typedef std::vector<short>::iterator IT;
 class cuts
 {
 public:
-	cuts(std::vector<short>& tape, int aspc) :
+	cuts(std::vector<short>& tape, int aspc, const pulsetape* pulses = NULL) :
 	  m_tape(tape),
-		  m_aspc(aspc)
+		  m_aspc(aspc),
+		  m_pulses(pulses),
+		  m_pulse(0)
 	  {
 		  m_tapehead = m_tape.begin();
 	  };
@@ -148,6 +150,12 @@ public:
 
 	  IT m_tapehead;
 
+	  // Or a CSW's pulses, and the next one. A pulse is a half cycle, so
+	  //  it's what countSimilarSamples would have counted.
+	  //
+	  const pulsetape* m_pulses;
+	  size_t m_pulse;
+
 
 	  // Start here.
 	  //
@@ -199,6 +207,15 @@ public:
 	  {
 		  count = 0;
 
+		  if (m_pulses)
+		  {
+			  if (m_pulse < m_pulses->pulseCount())
+			  {
+				  count = int(m_pulses->m_pulses[m_pulse++]);
+			  }
+			  return m_pulse < m_pulses->pulseCount();
+		  }
+
 		  int hilo = SGN(*m_tapehead);
 		  while (m_tapehead != m_tape.end() && SGN(*m_tapehead) == hilo)
 		  {
@@ -239,6 +256,7 @@ public:
 	  {
 		  int count;
 		  IT cursor;
+		  size_t pulse;
 
 		  // Look for a cycle with a period greater than the average 
 		  // samples per cycle at 2400hz.
@@ -258,6 +276,7 @@ public:
 		  do
 		  {
 			  cursor = m_tapehead;
+			  pulse = m_pulse;
 
 			  if (!getCycleCount(count))
 			  {
@@ -267,6 +286,7 @@ public:
 		  while (count < m_aspc * 3 / 2);
 
 		  m_tapehead = cursor;
+		  m_pulse = pulse;
 		  return true;
 	  }
 
@@ -380,6 +400,7 @@ int main(int argc, char** argv)
 		std::cout << std::endl;
 		std::cout << "Produces output like *cat when fed an Atom cassette image." << std::endl;
 		std::cout << "More useful as source than exe! WAVs should be 16 bit, mono." << std::endl;
+		std::cout << "CSWs will do too, and FLACs up to 24 bit." << std::endl;
 		return 1;
 	}
 
@@ -396,31 +417,70 @@ int main(int argc, char** argv)
 		}
 	}
 
-	BYTE buffer[1024];
-	in.read((char*)buffer, sizeof(RIFFHEADER));
-	RIFFHEADER* riffhdr = (RIFFHEADER*)buffer;
-
-	FMTHEADER fmthdr;
-	in.read((char*)&fmthdr, sizeof(FMTHEADER));
+	// A CSW's pulses go to the decoder as they are, no samples needed.
+	//
+	char signature[22] = { 0 };
+	in.read(signature, sizeof(signature));
+	in.clear();
+	in.seekg(0);
+	bool csw = memcmp(signature, "Compressed Square Wave", sizeof(signature)) == 0;
+	bool flac = memcmp(signature, "fLaC", 4) == 0;
+
+	std::vector<short> databuffer;
+	pulsetape pulses;
+	int avgSamplesPerCycleAt2400hz;
+
+	if (csw)
+	{
+		int sampleRate;
+		const char* error;
+		if (!readcsw(in, pulses, sampleRate, error))
+		{
+			std::cout << error << std::endl;
+			return 1;
+		}
 
-	if (fmthdr.bitsPerSample != 16 || fmthdr.channels != 1)
+		avgSamplesPerCycleAt2400hz = sampleRate / 2400;
+	}
+	else if (flac)
 	{
-		std::cout << "Wav should be mono, 16 bit please." << std::endl;
-		return 1;
+		int sampleRate;
+		const char* error;
+		if (!readflac(in, databuffer, sampleRate, error))
+		{
+			std::cout << error << std::endl;
+			return 1;
+		}
+
+		avgSamplesPerCycleAt2400hz = sampleRate / 2400;
 	}
+	else
+	{
+		BYTE buffer[1024];
+		in.read((char*)buffer, sizeof(RIFFHEADER));
+		RIFFHEADER* riffhdr = (RIFFHEADER*)buffer;
+
+		FMTHEADER fmthdr;
+		in.read((char*)&fmthdr, sizeof(FMTHEADER));
 
-	int avgSamplesPerCycleAt2400hz = fmthdr.samplesPerSec / 2400;
+		if (fmthdr.bitsPerSample != 16 || fmthdr.channels != 1)
+		{
+			std::cout << "Wav should be mono, 16 bit please." << std::endl;
+			return 1;
+		}
 
-	in.read((char*)buffer, sizeof(DATACHUNK));
-	DATACHUNK* datachk = (DATACHUNK*)buffer;
+		avgSamplesPerCycleAt2400hz = fmthdr.samplesPerSec / 2400;
 
-	std::vector<short> databuffer(datachk->chunkSize);
+		in.read((char*)buffer, sizeof(DATACHUNK));
+		DATACHUNK* datachk = (DATACHUNK*)buffer;
 
-	short* data = &databuffer.front();
-	in.read((char*)data, (std::streamsize)databuffer.size() * sizeof(short));
+		databuffer.resize(datachk->chunkSize);
 
+		short* data = &databuffer.front();
+		in.read((char*)data, (std::streamsize)databuffer.size() * sizeof(short));
+	}
 
-	cuts likeAKnife(databuffer, avgSamplesPerCycleAt2400hz);
+	cuts likeAKnife(databuffer, avgSamplesPerCycleAt2400hz, csw ? &pulses : NULL);
 
 	std::cout << "PLAY TAPE" << std::endl;
 
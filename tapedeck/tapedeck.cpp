@@ -0,0 +1,1066 @@
+/*
+
+tapedeck
+By Charlie Robson
+
+charlie_robson@hotmail.com
+arduinonut.blogspot.com
+
+Virtual cassette decks. Load a deck with an ATM, a TAP or a WAV, point an
+emulator or a capture rig at its output and work it like a tape deck: play,
+stop, rewind, or skip straight to a block.
+
+Each deck's output is a FIFO or a local socket, or a named pipe on Windows.
+Whoever opens it gets a WAV header and then the tape as it plays, 16 bit
+mono, paced to real time or as fast as they'll take it. While the deck's
+stopped they get silence, as off a real deck, unless it's running fast in
+which case they get nothing.
+
+ATMs and TAPs are rendered through freqout a block at a time as the tape
+gets to them, nothing's made ahead. WAVs are played as they are, and
+blocks are found by the cue points atm2wav puts in.
+
+Any number of decks can run at once, each on its own thread. They're told
+what to do a line at a time on stdin, or through a control FIFO:
+
+deck 1 /tmp/deck1       Make deck 1, playing into /tmp/deck1.
+load 1 game.tap         Put a tape in it.
+play 1                  And so on.
+
+*/
+
+#define VERSION "1.0.0"
+
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include <string.h>
+#include <errno.h>
+
+#include "shared\argcrack.h"
+#include "shared\defines.h"
+#include "shared\atmheader.h"
+#include "shared\freqout.h"
+#include "shared\wavfile.h"
+
+
+
+// m:ss.sss for a stretch of tape 'samples' long.
+//
+std::string playTime(long long samples, int sampleRate)
+{
+	long long ms = (samples * 1000 + sampleRate / 2) / sampleRate;
+
+	std::ostringstream text;
+	text << ms / 60000 << ":" << std::setfill('0') << std::setw(2) << ms / 1000 % 60 << "." << std::setw(3) << ms % 1000;
+	return text.str();
+}
+
+
+
+// A tape in a deck. Samples can be had from anywhere on it in any order,
+// so seeking's just a matter of reading from somewhere else.
+//
+class tapeimage
+{
+public:
+	virtual ~tapeimage()
+	{
+	}
+
+	// Up to 'count' samples from 'pos' on, returns how many. Fewer means
+	// that's the end of the tape.
+	//
+	virtual size_t read(long long pos, short* out, size_t count) = 0;
+
+	long long length(void) const
+	{
+		return _length;
+	}
+
+	int sampleRate(void) const
+	{
+		return _sampleRate;
+	}
+
+	// Where each block's leader starts, and what to call it.
+	//
+	std::vector<long long> _blockStarts;
+	std::vector<std::string> _blockNames;
+
+protected:
+	long long _length;
+	int _sampleRate;
+};
+
+
+
+// ATMs, one or a TAP's worth, rendered as they're played. The whole tape's
+// laid out when it's loaded, as atm2wav would lay it out, but a block's
+// samples aren't made until something reads them. Just the one block is
+// kept.
+//
+class atmimage : public tapeimage
+{
+public:
+	atmimage(std::vector<std::vector<BYTE> >& programs, int sampleRate, const tapetiming& timing, int gap, bool unnamed) :
+		_unused(NULL),
+		_fo(NULL, _unused, sampleRate),
+		_timing(timing),
+		_unnamed(unnamed),
+		_cached(-1)
+	{
+		_programs.swap(programs);
+		_sampleRate = sampleRate;
+
+		freqoutT<pcm16> planner(NULL, _unused, sampleRate);
+
+		long long start = 0;
+		for (size_t i = 0; i < _programs.size(); ++i)
+		{
+			planner._rawData = &_programs[i].front();
+			const ATMHEADER* atm = (const ATMHEADER*)planner._rawData;
+			std::string name(atm->filename, strnlen(atm->filename, 16));
+
+			piece part;
+			part.program = i;
+			part.gap = 0;
+			part.phase = 0;
+			part.sample = start;
+
+			if (_unnamed)
+			{
+				_pieces.push_back(part);
+				_blockStarts.push_back(start);
+				_blockNames.push_back(name);
+			}
+			else
+			{
+				std::vector<freqout::blockplan> blocks;
+				planner.planBlocks(timing, blocks);
+				for (size_t b = 0; b < blocks.size(); ++b)
+				{
+					part.block = blocks[b];
+					part.sample = start + planner.bitStart(blocks[b].firstBit, part.phase);
+					_pieces.push_back(part);
+					_blockStarts.push_back(part.sample);
+					_blockNames.push_back(name + " block " + std::to_string(b));
+				}
+			}
+
+			start += planner.tapeSamples(timing, unnamed);
+
+			if (gap && i + 1 < _programs.size())
+			{
+				part.gap = gap;
+				part.phase = 0;
+				part.sample = start;
+				_pieces.push_back(part);
+				start += planner.gapSamples(gap);
+			}
+		}
+
+		_length = start;
+	}
+
+	virtual size_t read(long long pos, short* out, size_t count)
+	{
+		size_t done = 0;
+		while (done < count && pos < _length)
+		{
+			// The piece 'pos' is in, the last to start at or before it.
+			//
+			size_t i = 0, j = _pieces.size();
+			while (j - i > 1)
+			{
+				size_t mid = (i + j) / 2;
+				(_pieces[mid].sample <= pos ? i : j) = mid;
+			}
+
+			if ((int)i != _cached)
+			{
+				render(i);
+			}
+
+			long long offset = pos - _pieces[i].sample;
+			size_t n = (size_t)std::min((long long)(count - done), (long long)_samples.size() - offset);
+			memcpy(out + done, &_samples[(size_t)offset], n * sizeof(short));
+			done += n;
+			pos += n;
+		}
+		return done;
+	}
+
+private:
+	// A block, an unnamed program or the silence after a program, and
+	// where it starts.
+	//
+	struct piece
+	{
+		size_t program;
+		freqout::blockplan block;
+		int gap;
+		long long sample;
+		int phase;
+	};
+
+	void render(size_t i)
+	{
+		const piece& part = _pieces[i];
+		long long end = i + 1 < _pieces.size() ? _pieces[i + 1].sample : _length;
+
+		std::vector<char> bytes((size_t)(end - part.sample) * 2);
+		_fo._direct = &bytes[0];
+		_fo._phase = part.phase;
+		if (part.gap)
+		{
+			_fo.outGap(part.gap);
+		}
+		else if (_unnamed)
+		{
+			_fo._rawData = &_programs[part.program].front();
+			_fo.writeunnamed(_timing);
+		}
+		else
+		{
+			_fo.writeBlock(part.block);
+		}
+
+		_samples.resize(bytes.size() / 2);
+		freqout::decodeAs<pcm16>(&bytes[0], _samples.size(), &_samples[0]);
+		_cached = (int)i;
+	}
+
+	std::vector<std::vector<BYTE> > _programs;
+	std::vector<piece> _pieces;
+
+	std::ostream _unused;
+	freqoutT<pcm16> _fo;
+	tapetiming _timing;
+	bool _unnamed;
+
+	int _cached;
+	std::vector<short> _samples;
+};
+
+
+
+// A WAV, 16 bit mono, played as it is. If atm2wav made it there are cue
+// points at every block's leader to seek to.
+//
+class wavimage : public tapeimage
+{
+public:
+	wavimage() :
+		_tape(NULL)
+	{
+	}
+
+	~wavimage()
+	{
+		delete _tape;
+	}
+
+	bool open(const std::string& name, const char*& error)
+	{
+		_in.open(name.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (!_in.is_open())
+		{
+			error = "Can't open it.";
+			return false;
+		}
+
+		size_t length;
+		if (!readwavheader(_in, _sampleRate, length, error))
+		{
+			return false;
+		}
+		_length = (long long)length;
+
+		std::streampos data = _in.tellg();
+		readCues(data + std::streamoff(length * 2));
+		_in.clear();
+		_in.seekg(data);
+
+		_tape = new wavtape(_in, length);
+		return true;
+	}
+
+	virtual size_t read(long long pos, short* out, size_t count)
+	{
+		size_t done = 0;
+		while (done < count)
+		{
+			const short* samples;
+			size_t n = _tape->fetch((size_t)pos + done, samples, count - done);
+			if (!n)
+			{
+				break;
+			}
+			n = std::min(n, count - done);
+			memcpy(out + done, samples, n * sizeof(short));
+			done += n;
+		}
+		return done;
+	}
+
+private:
+	// The cue and LIST/adtl chunks after the data. A cue labelled as a
+	// leader marks a block, or if nothing's labelled every cue does.
+	//
+	void readCues(std::streampos chunks)
+	{
+		std::map<DWORD, long long> cues;
+		std::map<DWORD, std::string> labels;
+
+		_in.clear();
+		_in.seekg(chunks);
+
+		DATACHUNK chunk;
+		while (_in.read((char*)&chunk, sizeof(chunk)))
+		{
+			std::streampos next = _in.tellg() + std::streamoff((chunk.chunkSize + 1) & ~1);
+
+			if (memcmp(chunk.chunkid, "cue ", 4) == 0)
+			{
+				DWORD count = 0;
+				_in.read((char*)&count, 4);
+				for (DWORD i = 0; i < count && _in; ++i)
+				{
+					DWORD point[6];
+					_in.read((char*)point, sizeof(point));
+					cues[point[0]] = point[5];
+				}
+			}
+			else if (memcmp(chunk.chunkid, "LIST", 4) == 0)
+			{
+				char type[4];
+				_in.read(type, 4);
+				std::streampos end = next;
+				while (memcmp(type, "adtl", 4) == 0 && _in.tellg() < end && _in.read((char*)&chunk, sizeof(chunk)))
+				{
+					std::streampos after = _in.tellg() + std::streamoff((chunk.chunkSize + 1) & ~1);
+					if (memcmp(chunk.chunkid, "labl", 4) == 0 && chunk.chunkSize > 4)
+					{
+						DWORD id;
+						std::string text(chunk.chunkSize - 4, 0);
+						_in.read((char*)&id, 4);
+						_in.read(&text[0], (std::streamsize)text.size());
+						labels[id] = text.c_str();
+					}
+					_in.seekg(after);
+				}
+			}
+
+			_in.seekg(next);
+		}
+
+		std::vector<std::pair<long long, std::string> > blocks;
+		for (std::map<DWORD, long long>::iterator cue = cues.begin(); cue != cues.end(); ++cue)
+		{
+			std::string label = labels[cue->first];
+			const std::string leader = " leader";
+			bool isLeader = label.size() >= leader.size() && label.compare(label.size() - leader.size(), leader.size(), leader) == 0;
+			if (labels.empty() || isLeader)
+			{
+				std::string name = labels.empty() ? "cue " + std::to_string(cue->first) : label.substr(0, label.size() - leader.size());
+				blocks.push_back(std::make_pair(cue->second, name));
+			}
+		}
+		std::sort(blocks.begin(), blocks.end());
+
+		for (size_t i = 0; i < blocks.size(); ++i)
+		{
+			_blockStarts.push_back(blocks[i].first);
+			_blockNames.push_back(blocks[i].second);
+		}
+	}
+
+	std::ifstream _in;
+	wavtape* _tape;
+};
+
+
+
+// Where a deck's sound goes. On Windows a named pipe, elsewhere a FIFO if
+// there's one at the path given, or failing that a local socket made
+// there. One listener at a time.
+//
+// Everything here returns straight away: waiting is the deck's business,
+// so it can keep up with what it's told.
+//
+class deckport
+{
+public:
+	deckport(const std::string& path) :
+		_path(path)
+	{
+#ifdef _WIN32
+		_pipe = INVALID_HANDLE_VALUE;
+		_connected = false;
+#else
+		_fd = -1;
+		_listener = -1;
+		struct stat info;
+		_fifo = stat(path.c_str(), &info) == 0 && S_ISFIFO(info.st_mode);
+#endif
+	}
+
+	~deckport()
+	{
+		hangUp();
+#ifdef _WIN32
+		if (_pipe != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(_pipe);
+		}
+#else
+		if (_listener >= 0)
+		{
+			close(_listener);
+			unlink(_path.c_str());
+		}
+#endif
+	}
+
+	// Gets whatever's needed in place to be connected to. False if that
+	// can't be done.
+	//
+	bool open(void)
+	{
+#ifdef _WIN32
+		std::string name = _path.compare(0, 9, "\\\\.\\pipe\\") == 0 ? _path : "\\\\.\\pipe\\" + _path;
+		_pipe = CreateNamedPipeA(name.c_str(), PIPE_ACCESS_OUTBOUND, PIPE_TYPE_BYTE | PIPE_NOWAIT, 1, 1 << 16, 0, 0, NULL);
+		return _pipe != INVALID_HANDLE_VALUE;
+#else
+		if (_fifo)
+		{
+			return true;
+		}
+
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (_path.size() >= sizeof(address.sun_path))
+		{
+			return false;
+		}
+		strcpy(address.sun_path, _path.c_str());
+		unlink(_path.c_str());
+
+		_listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (_listener < 0 || bind(_listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(_listener, 1) != 0)
+		{
+			return false;
+		}
+		fcntl(_listener, F_SETFL, O_NONBLOCK);
+		return true;
+#endif
+	}
+
+	// True if someone's listening, taking them on if they've just turned up.
+	// The pipe or socket stays non-blocking, see write.
+	//
+	bool connected(void)
+	{
+#ifdef _WIN32
+		if (!_connected)
+		{
+			_connected = !ConnectNamedPipe(_pipe, NULL) && GetLastError() == ERROR_PIPE_CONNECTED;
+		}
+		return _connected;
+#else
+		if (_fd < 0 && _fifo)
+		{
+			// Opening a FIFO to write fails until there's a reader.
+			//
+			_fd = ::open(_path.c_str(), O_WRONLY | O_NONBLOCK);
+		}
+		else if (_fd < 0)
+		{
+			_fd = accept(_listener, NULL, NULL);
+			if (_fd >= 0)
+			{
+				fcntl(_fd, F_SETFL, O_NONBLOCK);
+			}
+		}
+		return _fd >= 0;
+#endif
+	}
+
+	// Sends the lot or hangs up trying. A listener that stops reading
+	// doesn't hold us up for good: while there's no room we wait 10ms at
+	// a time, and give up as soon as 'running' goes false.
+	//
+	bool write(const void* data, size_t length, const std::atomic<bool>& running)
+	{
+		const char* bytes = (const char*)data;
+		while (length)
+		{
+			if (!running)
+			{
+				hangUp();
+				return false;
+			}
+
+#ifdef _WIN32
+			DWORD sent = 0;
+			if (!WriteFile(_pipe, bytes, (DWORD)length, &sent, NULL))
+			{
+				hangUp();
+				return false;
+			}
+			if (!sent)
+			{
+				Sleep(10);
+				continue;
+			}
+#else
+			ssize_t sent = _fifo ? ::write(_fd, bytes, length) : send(_fd, bytes, length, MSG_NOSIGNAL);
+			if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				pollfd waiting = { _fd, POLLOUT, 0 };
+				poll(&waiting, 1, 10);
+				continue;
+			}
+			if (sent <= 0)
+			{
+				hangUp();
+				return false;
+			}
+#endif
+			bytes += sent;
+			length -= sent;
+		}
+		return true;
+	}
+
+	void hangUp(void)
+	{
+#ifdef _WIN32
+		if (_connected)
+		{
+			DisconnectNamedPipe(_pipe);
+			_connected = false;
+		}
+#else
+		if (_fd >= 0)
+		{
+			close(_fd);
+			_fd = -1;
+		}
+#endif
+	}
+
+private:
+	std::string _path;
+
+#ifdef _WIN32
+	HANDLE _pipe;
+	bool _connected;
+#else
+	bool _fifo;
+	int _fd;
+	int _listener;
+#endif
+};
+
+
+
+// A deck: a tape, a port and a motor. The deck runs on its own thread,
+// the commands just set its controls.
+//
+class deck
+{
+public:
+	deck(int number, const std::string& path, int sampleRate) :
+		_number(number),
+		_port(path),
+		_sampleRate(sampleRate),
+		_position(0),
+		_playing(false),
+		_speed(1),
+		_running(true)
+	{
+	}
+
+	~deck()
+	{
+		_running = false;
+		if (_thread.joinable())
+		{
+			_thread.join();
+		}
+	}
+
+	bool start(void)
+	{
+		if (!_port.open())
+		{
+			return false;
+		}
+		_thread = std::thread(&deck::run, this);
+		return true;
+	}
+
+	void load(std::shared_ptr<tapeimage> tape)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_tape = tape;
+		_position = 0;
+		_playing = false;
+	}
+
+	void play(bool playing)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_playing = playing && _tape && _position < _tape->length();
+	}
+
+	void seek(long long position)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_position = position;
+	}
+
+	void speed(int speed)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_speed = speed;
+	}
+
+	std::shared_ptr<tapeimage> tape(void)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		return _tape;
+	}
+
+	// Where the tape's got to, in words.
+	//
+	std::string status(void)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+
+		std::ostringstream text;
+		text << "deck " << _number << ": ";
+		if (!_tape)
+		{
+			text << "empty";
+			return text.str();
+		}
+
+		text << (_playing ? "playing" : "stopped");
+		if (_speed != 1)
+		{
+			text << (_speed ? " x" + std::to_string(_speed) : " fast");
+		}
+
+		const std::vector<long long>& starts = _tape->_blockStarts;
+		size_t block = std::upper_bound(starts.begin(), starts.end(), _position) - starts.begin();
+		if (block)
+		{
+			text << ", " << _tape->_blockNames[block - 1] << " (" << block - 1 << " of " << starts.size() << ")";
+		}
+		text << ", " << playTime(_position, _sampleRate) << " of " << playTime(_tape->length(), _sampleRate);
+		return text.str();
+	}
+
+private:
+	// Sends the tape out 10ms at a time, to time. Real time is kept from
+	// when play started rather than chunk by chunk, so it doesn't drift.
+	//
+	void run(void)
+	{
+		typedef std::chrono::steady_clock clock;
+
+		std::vector<short> chunk(_sampleRate / 100);
+		bool connected = false;
+		clock::time_point started = clock::now();
+		long long sent = 0;
+		int pacedAt = -1;
+
+		while (_running)
+		{
+			if (!_port.connected())
+			{
+				connected = false;
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				continue;
+			}
+
+			if (!connected)
+			{
+				connected = sendHeader();
+				pacedAt = -1;
+				continue;
+			}
+
+			std::shared_ptr<tapeimage> tape;
+			size_t n = chunk.size();
+			int speed;
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				tape = _tape;
+				speed = _speed;
+				if (_playing)
+				{
+					n = tape->read(_position, &chunk[0], chunk.size());
+					_position += n;
+					if (n < chunk.size())
+					{
+						// Run out of tape.
+						//
+						_playing = false;
+						std::cout << "deck " << _number << ": end of tape" << std::endl;
+					}
+				}
+				else
+				{
+					if (!speed)
+					{
+						n = 0;
+					}
+					memset(&chunk[0], 0, chunk.size() * sizeof(short));
+				}
+			}
+
+			if (!speed)
+			{
+				pacedAt = -1;
+				if (!n)
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					continue;
+				}
+			}
+			else
+			{
+				if (speed != pacedAt)
+				{
+					started = clock::now();
+					sent = 0;
+					pacedAt = speed;
+				}
+				sent += n;
+				std::this_thread::sleep_until(started + std::chrono::microseconds(sent * 1000000 / ((long long)_sampleRate * speed)));
+			}
+
+			connected = _port.write(&chunk[0], n * sizeof(short), _running);
+		}
+	}
+
+	// A WAV header that says it goes on forever, as streamed WAVs do.
+	//
+	bool sendHeader(void)
+	{
+		BYTE header[44];
+		memcpy(header, "RIFF\xff\xff\xff\xffWAVEfmt ", 16);
+		DWORD fields[4] = { 16, 1 | (1 << 16), (DWORD)_sampleRate, (DWORD)_sampleRate * 2 };
+		memcpy(header + 16, fields, 16);
+		WORD align[2] = { 2, 16 };
+		memcpy(header + 32, align, 4);
+		memcpy(header + 36, "data\xff\xff\xff\xff", 8);
+		return _port.write(header, sizeof(header), _running);
+	}
+
+	int _number;
+	deckport _port;
+	int _sampleRate;
+
+	std::mutex _lock;
+	std::shared_ptr<tapeimage> _tape;
+	long long _position;
+	bool _playing;
+	int _speed;
+
+	std::atomic<bool> _running;
+	std::thread _thread;
+};
+
+
+
+// Reads a tape image: an ATM, a TAP (ATMs end to end) or a WAV.
+//
+std::shared_ptr<tapeimage> loadTape(const std::string& name, int sampleRate, const tapetiming& timing, int gap, bool unnamed, std::string& error)
+{
+	std::string extension = name.size() > 4 ? name.substr(name.size() - 4) : "";
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	if (extension == ".wav")
+	{
+		std::shared_ptr<wavimage> wav(new wavimage);
+		const char* why;
+		if (!wav->open(name, why))
+		{
+			error = why;
+			return std::shared_ptr<tapeimage>();
+		}
+		if (wav->sampleRate() != sampleRate)
+		{
+			error = "It's " + std::to_string(wav->sampleRate()) + "hz, the decks are " + std::to_string(sampleRate) + "hz.";
+			return std::shared_ptr<tapeimage>();
+		}
+		return wav;
+	}
+
+	std::ifstream in(name.c_str(), std::ios_base::in | std::ios_base::binary);
+	if (!in.is_open())
+	{
+		error = "Can't open it.";
+		return std::shared_ptr<tapeimage>();
+	}
+	std::vector<BYTE> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+	std::vector<std::vector<BYTE> > programs;
+	for (size_t index = 0; index + sizeof(ATMHEADER) <= bytes.size(); )
+	{
+		const ATMHEADER* header = (const ATMHEADER*)&bytes[index];
+		size_t size = sizeof(ATMHEADER) + header->length;
+		if (index + size > bytes.size())
+		{
+			break;
+		}
+		programs.push_back(std::vector<BYTE>(bytes.begin() + index, bytes.begin() + index + size));
+		index += size;
+	}
+
+	if (programs.empty())
+	{
+		error = "No programs in it.";
+		return std::shared_ptr<tapeimage>();
+	}
+
+	return std::shared_ptr<tapeimage>(new atmimage(programs, sampleRate, timing, gap, unnamed));
+}
+
+
+
+int main(int argc, char** argv)
+{
+	argcrack param(argc, argv);
+
+	if (param.ispresent("/?") || param.ispresent("-?") || param.ispresent("?"))
+	{
+		std::cout << "TAPEDECK V" << VERSION << std::endl;
+		std::cout << std::endl;
+		std::cout << "Virtual cassette decks, playing ATMs, TAPs and WAVs in real time" << std::endl;
+		std::cout << "to FIFOs, local sockets or named pipes." << std::endl;
+		std::cout << std::endl;
+		std::cout << "Usage: tapedeck [options]" << std::endl;
+		std::cout << std::endl;
+		std::cout << "Options:" << std::endl;
+		std::cout << "rate=    Sample rate of every deck, default 44100." << std::endl;
+		std::cout << "control= Take commands from this FIFO instead of stdin." << std::endl;
+		std::cout << "short    Short leaders when rendering ATMs." << std::endl;
+		std::cout << "gap=     Silence between the programs of a TAP in ms, default 2000." << std::endl;
+		std::cout << "unnamed  Render ATMs as unnamed files." << std::endl;
+		std::cout << std::endl;
+		std::cout << "Commands, one a line:" << std::endl;
+		std::cout << "deck <n> <path>    Make deck n, playing to <path>." << std::endl;
+		std::cout << "load <n> <file>    Load an ATM, TAP or 16 bit mono WAV, rewound." << std::endl;
+		std::cout << "play <n>           Play." << std::endl;
+		std::cout << "stop <n>           Stop." << std::endl;
+		std::cout << "rewind <n>         Back to the start." << std::endl;
+		std::cout << "seek <n> <block>   To the leader of a block, counting from 0." << std::endl;
+		std::cout << "speed <n> <x>      1 for real time, 2 for twice that.. 0 as fast as it goes." << std::endl;
+		std::cout << "status [n]         Where the tape's got to." << std::endl;
+		std::cout << "eject <n>          Take the deck away." << std::endl;
+		std::cout << "quit" << std::endl;
+		return 1;
+	}
+
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	int sampleRate = 44100;
+	param.getint("rate", sampleRate);
+	if (sampleRate < 8000 || sampleRate > 192000)
+	{
+		std::cerr << "Sample rate should be 8000 to 192000hz." << std::endl;
+		return 1;
+	}
+
+	int gap = 2000;
+	param.getint("gap", gap);
+	if (gap < 0)
+	{
+		gap = 0;
+	}
+
+	tapetiming timing = param.ispresent("short") ? TIMING_SHORT : TIMING_STANDARD;
+	bool unnamed = param.ispresent("unnamed");
+
+	std::string controlName;
+	bool haveControl = param.getstring("control", controlName);
+	std::ifstream control;
+
+	std::map<int, std::shared_ptr<deck> > decks;
+
+	for (;;)
+	{
+		// A FIFO runs dry every time its writer lets go. Open it again
+		// and wait for the next.
+		//
+		std::string line;
+		if (haveControl)
+		{
+			if (!control.is_open())
+			{
+				control.open(controlName.c_str());
+				if (!control.is_open())
+				{
+					std::cerr << "Can't open control " << controlName.c_str() << "." << std::endl;
+					return 1;
+				}
+			}
+			if (!std::getline(control, line))
+			{
+				control.close();
+				control.clear();
+				continue;
+			}
+		}
+		else if (!std::getline(std::cin, line))
+		{
+			break;
+		}
+
+		std::istringstream words(line);
+		std::string command;
+		int number = -1;
+		words >> command >> number;
+		if (command.empty() || command[0] == '#')
+		{
+			continue;
+		}
+
+		if (command == "quit")
+		{
+			break;
+		}
+
+		if (command == "status" && number < 0)
+		{
+			for (std::map<int, std::shared_ptr<deck> >::iterator i = decks.begin(); i != decks.end(); ++i)
+			{
+				std::cout << i->second->status() << std::endl;
+			}
+			continue;
+		}
+
+		if (command == "deck")
+		{
+			std::string path;
+			words >> path;
+			if (number < 0 || path.empty() || decks.count(number))
+			{
+				std::cout << "deck " << number << ": needs a new number and a path." << std::endl;
+				continue;
+			}
+
+			std::shared_ptr<deck> d(new deck(number, path, sampleRate));
+			if (!d->start())
+			{
+				std::cout << "deck " << number << ": can't play to " << path.c_str() << "." << std::endl;
+				continue;
+			}
+			decks[number] = d;
+			std::cout << "deck " << number << ": ready on " << path.c_str() << std::endl;
+			continue;
+		}
+
+		if (!decks.count(number))
+		{
+			std::cout << "No deck " << number << "." << std::endl;
+			continue;
+		}
+		std::shared_ptr<deck> d = decks[number];
+
+		if (command == "load")
+		{
+			std::string name;
+			std::getline(words >> std::ws, name);
+			std::string error;
+			std::shared_ptr<tapeimage> tape = loadTape(name, sampleRate, timing, gap, unnamed, error);
+			if (!tape)
+			{
+				std::cout << "deck " << number << ": can't load " << name.c_str() << ". " << error.c_str() << std::endl;
+				continue;
+			}
+			d->load(tape);
+		}
+		else if (command == "play" || command == "stop")
+		{
+			d->play(command == "play");
+		}
+		else if (command == "rewind")
+		{
+			d->seek(0);
+		}
+		else if (command == "seek")
+		{
+			int block = -1;
+			words >> block;
+			std::shared_ptr<tapeimage> tape = d->tape();
+			if (!tape || block < 0 || block >= (int)tape->_blockStarts.size())
+			{
+				std::cout << "deck " << number << ": no block " << block << "." << std::endl;
+				continue;
+			}
+			d->seek(tape->_blockStarts[block]);
+		}
+		else if (command == "speed")
+		{
+			int speed = -1;
+			words >> speed;
+			if (speed < 0)
+			{
+				std::cout << "deck " << number << ": speed is 0 for flat out, 1 for real time or more." << std::endl;
+				continue;
+			}
+			d->speed(speed);
+		}
+		else if (command == "eject")
+		{
+			decks.erase(number);
+			std::cout << "deck " << number << ": gone" << std::endl;
+			continue;
+		}
+		else if (command != "status")
+		{
+			std::cout << "What's " << command.c_str() << "?" << std::endl;
+			continue;
+		}
+
+		std::cout << d->status() << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,236 @@
+/*
+
+uef2atm
+By Charlie Robson
+
+charlie_robson@hotmail.com
+arduinonut.blogspot.com
+
+Splits a .uef emulator tape image into the .atm files on it.
+
+A UEF keeps the bytes that were on the tape rather than the sound of them,
+so there's nothing to decode. The blocks are picked out of the data chunks
+and put back together into ATMs, just as wav2atm does with a recording.
+
+*/
+
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+
+#include <direct.h>
+
+#include "shared\argcrack.h"
+#include "shared\defines.h"
+#include "shared\atmheader.h"
+#include "shared\nameconv.h"
+#include "shared\ueffile.h"
+
+
+#define VERSION "1.0.0"
+
+
+std::string hex(int val, int width)
+{
+	char fmtstring[16];
+	sprintf_s(fmtstring, 16, "%%0%dX", width);
+
+	char buffer[16];
+	sprintf_s(buffer, 16, fmtstring, val);
+	return std::string(buffer);
+}
+
+
+int main(int argc, char** argv)
+{
+	argcrack param(argc, argv);
+
+	if (argc < 2 || param.ispresent("/?") || param.ispresent("-?") || param.ispresent("?"))
+	{
+		std::cerr << std::endl;
+		std::cout << "UEF2ATM V" << VERSION << std::endl;
+		std::cout << std::endl;
+		std::cout << "Splits a .UEF emulator tape image into the .ATM files on it." << std::endl;
+		std::cout << "Gzipped UEFs are fine as they are." << std::endl;
+		std::cout << std::endl;
+		std::cout << "Usage: uef2atm ueffile[.uef] [options]" << std::endl;
+		std::cerr << std::endl;
+		std::cerr << "Options:" << std::endl;
+		std::cerr << std::endl;
+		std::cerr << "mkdir    - Place .atm files in a directory named after the uef file." << std::endl;
+		std::cerr << "detailed - Output filename with extra information." << std::endl;
+		std::cerr << std::endl;
+		return 1;
+	}
+
+	std::string inName = argv[1];
+	std::ifstream in(inName.c_str(), std::ios_base::in | std::ios_base::binary);
+	if (!in.is_open())
+	{
+		inName += ".uef";
+		in.open(inName.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (!in.is_open())
+		{
+			std::cerr << "Invalid input file " << argv[1] << "." << std::endl;
+			return 1;
+		}
+	}
+
+	ueftape uef;
+	const char* error;
+	if (!uef.read(in, error))
+	{
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	std::string outDir(".");
+	if (param.ispresent("mkdir"))
+	{
+		outDir = inName;
+		size_t pos = outDir.find_last_of(".");
+		if (pos != std::string::npos)
+		{
+			outDir.erase(pos);
+		}
+		std::transform(outDir.begin(), outDir.end(), outDir.begin(), ::tolower);
+		_mkdir(outDir.c_str());
+	}
+
+	std::string baseName = inName;
+	size_t slashpos = baseName.find_last_of("\\/");
+	if (slashpos != std::string::npos)
+	{
+		baseName = baseName.substr(slashpos + 1);
+	}
+
+	int n = 0;
+
+	while (!uef.atEnd())
+	{
+		atmheader atm;
+		std::vector<BYTE> byteBuffer;
+
+		tapeblock block;
+		bool unnamed = false;
+
+		do
+		{
+			if (!uef.readBlock(block, error))
+			{
+				if (error == NULL && byteBuffer.empty())
+				{
+					unnamed = true;
+					break;
+				}
+
+				std::cerr << (error ? error : "Failed reading preamble.") << std::endl;
+				return 1;
+			}
+
+			if (block.isFirst() || byteBuffer.empty())
+			{
+				// A file that's cut short, its last block never came.
+				//
+				if (!byteBuffer.empty())
+				{
+					std::string partName(atm.header.filename, strnlen(atm.header.filename, 16));
+					std::cerr << "Dropped " << partName << ", " << byteBuffer.size()
+						<< " bytes in with no last block before the next file." << std::endl;
+				}
+
+				memcpy_s(atm.header.filename, 16, block.name, 14);
+				atm.header.exec = block.runAddress();
+				atm.header.start = block.loadAddress();
+				atm.header.length = 0;
+				byteBuffer.clear();
+			}
+
+			atm.header.length += block.length();
+			byteBuffer.insert(byteBuffer.end(), block.data, block.data + block.length());
+		}
+		while (!block.isLast());
+
+		if (unnamed)
+		{
+			// An address header, end then start, and the data. Nothing
+			// on the tape to call it, so it's named after the UEF.
+			//
+			int endAddr = block.preamble[0] * 256 + block.preamble[1];
+			int startAddr = block.preamble[2] * 256 + block.preamble[3];
+			if (endAddr <= startAddr)
+			{
+				std::cerr << "Bad unnamed file addresses " << hex(startAddr, 4) << "-" << hex(endAddr, 4) << "." << std::endl;
+				return 1;
+			}
+
+			byteBuffer.resize(endAddr - startAddr);
+			for (size_t i = 0; i < byteBuffer.size(); ++i)
+			{
+				if (!uef.getByte(byteBuffer[i]))
+				{
+					std::cerr << "Failed reading data." << std::endl;
+					return 1;
+				}
+			}
+
+			std::string atomName = pc_to_atom(baseName.c_str());
+
+			memset(atm.header.filename, 0, 16);
+			memcpy_s(atm.header.filename, 16, atomName.c_str(), atomName.size());
+			atm.header.start = startAddr;
+			atm.header.exec = startAddr;
+			atm.header.length = (WORD)byteBuffer.size();
+		}
+
+		// Atom filename may have control chars in. Preserve these in the binary
+		//
+		std::string atmName(atm.header.filename, strnlen(atm.header.filename, 16));
+		for(size_t i = 0; i < atmName.length(); ++i)
+		{
+			if (atmName[i] < 32)
+			{
+				atmName[i] = '-';
+			}
+		}
+
+		std::stringstream destName;
+		if (param.ispresent("detailed"))
+		{
+			destName << baseName << "." << n << "." << atmName;
+		}
+		else
+		{
+			destName << atmName;
+		}
+
+		std::string outName = outDir + "\\" + destName.str();
+		std::ofstream out(outName.c_str(), std::ios_base::out | std::ios_base::binary);
+		if (out.is_open())
+		{
+			atm.write(out);
+			if (!byteBuffer.empty())
+			{
+				out.write((const char*)&byteBuffer.front(), std::streamsize(atm.header.length));
+			}
+
+			std::cout << "Written " << destName.str() << "     "
+				<< " " << hex(atm.header.start, 4)
+				<< " " << hex(atm.header.exec, 4)
+				<< " " << hex(atm.header.length, 4)
+				<< std::endl;
+		}
+		else
+		{
+			std::cerr << "Invalid output file: " << destName.str() << std::endl;
+		}
+
+		++n;
+	}
+
+	return 0;
+}
@@ -29,7 +29,7 @@ http://www.stairwaytohell.com/atom/wouterras/romdisas.zip
 
 */
 
-#define VERSION "1.1.0"
+#define VERSION "1.2.0"
 
 
 #include <iostream>
@@ -37,6 +37,7 @@ http://www.stairwaytohell.com/atom/wouterras/romdisas.zip
 #include <string>
 #include <sstream>
 #include <vector>
+#include <memory>
 
 #include <math.h>
 
@@ -44,327 +45,124 @@ http://www.stairwaytohell.com/atom/wouterras/romdisas.zip
 #include "shared\defines.h"
 #include "shared\atmheader.h"
 #include "shared\nameconv.h"
+#include "shared\wavfile.h"
+#include "shared\cswfile.h"
+#include "shared\flacfile.h"
+#include "shared\cuts.h"
+#include "shared\freqout.h"
 
 
 
-#define _BV(x) (1<<(x))
-#define SGN(x) ((x)<0?-1:1)
 #define SUPERCHEESYFUNC
 
 
-// Set structure packing to byte boundaries
-// ... else strange things are happening under vs2005.
-//
-// This may well be MS specific, adjust to taste.
-//
-#pragma pack(push, 1)
-
-typedef struct
+SUPERCHEESYFUNC const char* torf(bool val)
 {
-	char chunkid[4];
-	DWORD chunkSize;
-	char format[4];
+	return val ? "Y" : "N";
 }
-RIFFHEADER;
 
-typedef struct
+SUPERCHEESYFUNC std::string hex(int val, int width)
 {
-	char chunkid[4];
-	DWORD chunkSize;
-	WORD foramtTag;
-	WORD channels;
-	DWORD samplesPerSec;
-	DWORD avgBytesPerSec;
-	WORD blockAlign;
-	WORD bitsPerSample;
-	// BYTE extradata [chunkSize-16]
-}
-FMTHEADER;
+	char fmtstring[16];
+	sprintf_s(fmtstring, 16, "%%0%dX", width);
 
-typedef struct
-{
-	char chunkid[4];
-	DWORD chunkSize;
+	char buffer[16];
+	sprintf_s(buffer, 16, fmtstring, val);
+	return std::string(buffer);
 }
-DATACHUNK;
 
-struct 
+
+// Says why the tape couldn't be read. A bad FLAC frame ends the tape
+// early, so if there was one that's the reason behind it.
+//
+int failed(const char* why, const flactape* flacs)
 {
-	// Ordered as received from tape
-	//
-	BYTE flags;
-	BYTE hiBlockNum, loBlockNum;
-	BYTE bytesInBlockMinus1;
-	BYTE hiRunAddress, loRunAddress;
-	BYTE hiBlockLoadAddress, loBlockLoadAddress;
+	std::cout << why << std::endl;
+	if (flacs && flacs->m_error)
+	{
+		std::cout << flacs->m_error << std::endl;
+	}
+	return 1;
 }
-atomTapeHeader;
 
-// Restore default structure packing
+
+// Reads the tape a block at a time and writes each one straight back out
+// clean, same names, flags and order. A block's only written once its
+// checksum is good, and nothing but the block in hand is kept.
 //
-#pragma pack(pop)
+int remaster(cuts& likeAKnife, freqout& fo, const tapetiming& timing, const flactape* flacs)
+{
+	int leaderTime = timing.lead;
 
+	tapeblock block;
+	const char* error;
+	bool first = true;
 
+	do
+	{
+		if (!likeAKnife.readBlock(block, error))
+		{
+			if (error == NULL && first)
+			{
+				break;
+			}
 
-SUPERCHEESYFUNC const char* torf(bool val)
-{
-	return val ? "Y" : "N";
-}
+			return failed(error ? error : "Failed reading preamble.", flacs);
+		}
 
-SUPERCHEESYFUNC std::string hex(int val, int width)
-{
-	char fmtstring[16];
-	sprintf_s(fmtstring, 16, "%%0%dX", width);
+		std::cout << block.name << "     "
+			<< " " << hex(block.loadAddress(), 4)
+			<< " " << hex(block.runAddress(), 4)
+			<< " " << hex(block.blockNum(), 4)
+			<< " " << hex(block.header.bytesInBlockMinus1, 2)
+			<< std::endl;
 
-	char buffer[16];
-	sprintf_s(buffer, 16, fmtstring, val);
-	return std::string(buffer);
-}
+		fo.writeBlock((const char*)block.name, block.header.flags, block.blockNum(), block.length(),
+			block.runAddress(), block.loadAddress(), block.data, leaderTime, timing.gap);
 
+		leaderTime = timing.leader;
+		first = false;
+	}
+	while (!block.isLast());
 
+	if (first)
+	{
+		// Unnamed. Copy the address header over then the data a byte at
+		// a time as it comes.
+		//
+		int endAddr = block.preamble[0] * 256 + block.preamble[1];
+		int startAddr = block.preamble[2] * 256 + block.preamble[3];
+		if (endAddr <= startAddr)
+		{
+			std::cout << "Bad unnamed file addresses " << hex(startAddr, 4) << "-" << hex(endAddr, 4) << "." << std::endl;
+			return 1;
+		}
 
+		std::cout << "<unnamed>" << "     "
+			<< " " << hex(startAddr, 4)
+			<< " " << hex(endAddr, 4)
+			<< std::endl;
 
-// And no, I didn't miss the obvious comical acronym ;)
-//
-typedef std::vector<short>::iterator IT;
+		fo.outTone(leaderTime);
+		for (int i = 0; i < 4; ++i)
+		{
+			fo.outByte(block.preamble[i]);
+		}
+
+		for (int i = startAddr; i < endAddr; ++i)
+		{
+			BYTE byte;
+			if (!likeAKnife.getByte(byte))
+			{
+				return failed("Failed reading data.", flacs);
+			}
+			fo.outByte(byte);
+		}
+	}
+
+	return 0;
+}
 
-class cuts
-{
-public:
-	cuts(std::vector<short>& tape, int aspc) :
-	  m_tape(tape),
-		  m_aspc(aspc)
-	  {
-		  m_tapehead = m_tape.begin();
-	  };
-
-	  int m_aspc;
-
-	  std::vector<short>& m_tape;
-
-	  IT m_tapehead;
-
-
-	  // Start here.
-	  //
-	  // Finds tone data in the stream. Should probably use some kind of filter,
-	  //  but I'm not that smart. Plus simple is good, right?
-	  //
-	  // Advances tapehead to first sample of new cycle of header tone.
-	  //
-	  bool findLeader(void)
-	  {
-		  // Locate leader.
-		  //
-		  int cycles = 0;
-		  while(cycles < 4096)
-		  {
-			  int count = 0;
-			  if (!countSimilarSamples(count))
-			  {
-				  return false;
-			  }
-
-			  // If the count we see is within 5% of the expected value,
-			  //  bump the cycle counter. The expected value is the number
-			  //  of samples that represents one cycle at 2400hz, IOW a high tone.
-			  //
-			  int diff = (abs(count - (m_aspc/2)) * 100) / m_aspc;
-			  if (diff < 6)
-			  {
-				  ++cycles;
-			  }
-			  else
-			  {
-				  cycles = 0;
-			  }
-		  }
-
-		  // Now go on to find start bit! Fly little one! Be free!
-
-		  return true;
-	  }
-
-
-	  // Counts the number of similarly-signed samples at the tapehead onward.
-	  // Assumes tapehead is at 1st sample with a sign different to that of its
-	  //  predecessor.
-	  // Advances tapehead to 1st sample with new sign.
-	  //
-	  bool countSimilarSamples(int& count)
-	  {
-		  count = 0;
-
-		  int hilo = SGN(*m_tapehead);
-		  while (m_tapehead != m_tape.end() && SGN(*m_tapehead) == hilo)
-		  {
-			  ++m_tapehead;
-			  ++count;
-		  }
-
-		  return m_tapehead != m_tape.end();
-	  }
-
-
-	  // Counts the number of samples forming one cycle.
-	  // Assumes tapehead is at 1st sample of a new cycle.
-	  // Advances tapehead to 1st sample of next cycle.
-	  //
-	  bool getCycleCount(int& count)
-	  {
-		  int loper, hiper;
-		  if (!countSimilarSamples(loper))
-		  {
-			  return false;
-		  }
-		  if (!countSimilarSamples(hiper))
-		  {
-			  return false;
-		  }
-
-		  count = loper + hiper;
-		  return true;
-	  }
-
-
-	  // Locates a start bit in the bitstream.
-	  // Assumes tapehead is at first sample of a high cycle.
-	  // Advances tapehead to the first sample of a startbit.
-	  //
-	  bool findStartBit(void)
-	  {
-		  int count;
-		  IT cursor;
-
-		  // Look for a cycle with a period greater than the average 
-		  // samples per cycle at 2400hz.
-		  //
-		  // |-- m_aspc --|
-		  // |-----||-----|
-		  // | lo  ||  hi |
-		  //
-		  // at 1200hz we have
-		  // |     lo     ||     hi     |
-		  //                      ^
-		  //                      1.5 * m_aspc
-		  //
-		  // So you can see that any sample count > (ofm_aspc * 1.5)
-		  // must be a 1200hz = low tone = 0 bit.
-		  //
-		  do
-		  {
-			  cursor = m_tapehead;
-
-			  if (!getCycleCount(count))
-			  {
-				  return false;
-			  }
-		  }
-		  while (count < m_aspc * 3 / 2);
-
-		  m_tapehead = cursor;
-		  return true;
-	  }
-
-
-	  // Gets a bit. 0 or 1 dude.
-	  // Assumes tapehead is at first sample of new bit.
-	  // Advances tapehead to start of next bit.
-	  //
-	  bool getBit(bool& bit)
-	  {
-		  int count;
-		  if (!getCycleCount(count))
-		  {
-			  return false;
-		  }
-
-		  // Reject the bit if we see a tone out of sequence.
-		  //
-		  if (count < m_aspc * 3 / 2)
-		  {
-			  // 8 cycles of 24khz. One down, 7 left in town.
-			  //
-			  bit = 1;
-			  for (int i = 0; i < 7; ++i)
-			  {
-				  getCycleCount(count);
-				  if (count > m_aspc * 3 / 2)
-				  {
-					  return false;
-				  }
-			  }
-		  }
-		  else
-		  {
-			  // 4 cycles of 12khz. One's been seen, we need three.
-			  //
-			  bit = 0;
-			  for (int i = 0; i < 3; ++i)
-			  {
-				  getCycleCount(count);
-				  if (count < m_aspc * 3 / 2)
-				  {
-					  return false;
-				  }
-			  }
-		  }
-
-		  return true;
-	  }
-
-
-	  // This should be pretty obvious.
-	  // Assumes tapehead is at first sample of new tone.
-	  // Advances tapehead to first sample after stop bit.
-	  //
-	  bool getByte(BYTE& byte)
-	  {
-		  // The tapehead can be at the start of a cycle of leader tone.
-		  // This leader may be as short as one cycle!
-		  // This is evident in fred.wav (recorded from a real Atom) which
-		  // exhibits the curious phenomena of having 9 cycles of high tone
-		  // in its stop bits. Treating this like a micro-leader allows the
-		  // handling of leader to be generic.
-		  //
-		  if (!findStartBit())
-		  {
-			  return 1;
-		  }
-
-		  bool bit;
-		  if (!getBit(bit) || bit)
-		  {
-			  return false;
-		  }
-
-		  byte = 0;
-		  for (int i = 0; i < 8; ++i)
-		  {
-			  if (!getBit(bit))
-			  {
-				  return false;
-			  }
-			  if (bit)
-			  {
-				  byte |= _BV(i);
-			  }
-		  }
-
-		  if (!getBit(bit) || !bit)
-		  {
-			  return false;
-		  }
-
-		  m_check += byte;
-
-		  return true;
-	  }
-
-	  BYTE m_check;
-};
-
-// todo - add support for unnamed files.
 
 int main(int argc, char** argv)
 {
@@ -375,13 +173,22 @@ int main(int argc, char** argv)
 		std::cout << "WAV2ATM V" << VERSION << std::endl;
 		std::cout << std::endl;
 		std::cout << "Produces .ATM file image of an atom program in WAV form." << std::endl;
-		std::cout << "WAVs should be 16 bit, mono. Programs should be BASIC, SAVEd" << std::endl;
+		std::cout << "WAVs should be 16 bit, mono. Programs can be SAVEd named or unnamed," << std::endl;
+		std::cout << "unnamed files are detected automatically and named after the output." << std::endl;
+		std::cout << "CSWs, v1 or v2, are read as they are, no need to make a WAV of them." << std::endl;
+		std::cout << "FLACs too, 8 to 24 bit. Only the first channel is used." << std::endl;
 		std::cout << std::endl;
 		std::cout << "Usage: wav2atm wavfile[.wav] [options]" << std::endl;
 		std::cout << std::endl;
 		std::cout << "Options:" << std::endl;
 		std::cout << std::endl;
 		std::cout << "out=   Specify output name. Optional, defaults to <infile>.atm" << std::endl;
+		std::cout << "noscan Don't pre-scan for tone, examine the whole tape." << std::endl;
+		std::cout << "hitone=, lotone=    Tone frequencies in hz. Default measured from the tape." << std::endl;
+		std::cout << "cycles1=, cycles0=  Cycles per 1 and 0 bit. Default measured from the tape." << std::endl;
+		std::cout << "remaster=  Write a clean copy of the tape to this WAV instead of an ATM." << std::endl;
+		std::cout << "           The tape is streamed, not pre-scanned. Takes atm2wav's 8bit" << std::endl;
+		std::cout << "           and short options." << std::endl;
 		return 1;
 	}
 
@@ -406,151 +213,213 @@ int main(int argc, char** argv)
 	}
 
 
-	BYTE buffer[1024];
-	in.read((char*)buffer, sizeof(RIFFHEADER));
-	RIFFHEADER* riffhdr = (RIFFHEADER*)buffer;
-
-	FMTHEADER fmthdr;
-	in.read((char*)&fmthdr, sizeof(FMTHEADER));
+	// Remastering streams the tape through a buffer at a time, otherwise
+	// it all goes into memory where the pre-scan can get at it. A CSW's
+	// pulses are small enough to go into memory either way. A FLAC's
+	// decoded a frame at a time as it's read, either way. The pre-scan
+	// only reads it through fetch and it rewinds for the decoder after.
+	//
+	std::string remasterName;
+	bool remastering = param.getstring("remaster", remasterName);
+
+	char signature[22] = { 0 };
+	in.read(signature, sizeof(signature));
+	in.clear();
+	in.seekg(0);
+	bool csw = memcmp(signature, "Compressed Square Wave", sizeof(signature)) == 0;
+	bool flac = memcmp(signature, "fLaC", 4) == 0;
+
+	std::vector<short> databuffer;
+	pulsetape pulses;
+	std::unique_ptr<flactape> flacs;
+	int sampleRate;
+	size_t length;
+	const char* error;
+	bool ok;
+	if (csw)
+	{
+		ok = readcsw(in, pulses, sampleRate, error);
+	}
+	else if (flac)
+	{
+		flacs.reset(new flactape(in));
+		ok = flacs->open(sampleRate, error);
+	}
+	else
+	{
+		ok = remastering ? readwavheader(in, sampleRate, length, error) : readwav(in, databuffer, sampleRate, error);
+	}
 
-	if (fmthdr.bitsPerSample != 16 || fmthdr.channels != 1)
+	if (!ok)
 	{
-		std::cout << "Wav should be mono, 16 bit please." << std::endl;
+		std::cout << error << std::endl;
 		return 1;
 	}
 
-	int avgSamplesPerCycleAt2400hz = fmthdr.samplesPerSec / 2400;
-
-	in.read((char*)buffer, sizeof(DATACHUNK));
-	DATACHUNK* datachk = (DATACHUNK*)buffer;
-
-	std::vector<short> databuffer(datachk->chunkSize);
-
-	short* data = &databuffer.front();
-	in.read((char*)data, (std::streamsize)databuffer.size() * sizeof(short));
-
-
-	BYTE atomFname[14];
-
 	atmheader atm;
 	std::vector<BYTE> byteBuffer(0);
 
-	cuts likeAKnife(databuffer, avgSamplesPerCycleAt2400hz);
-
-	bool lastBlock = false;
-
-	while(!lastBlock)
+	std::unique_ptr<tapesource> samples;
+	tapesource* source;
+	if (csw)
+	{
+		source = &pulses;
+	}
+	else if (flac)
+	{
+		source = flacs.get();
+	}
+	else
 	{
-		if (!likeAKnife.findLeader())
+		if (remastering)
 		{
-			std::cout << "Didn't find leader tone." << std::endl;
-			return 1;
+			samples.reset(new wavtape(in, length));
 		}
-
-		if (!likeAKnife.findStartBit())
+		else
 		{
-			std::cout << "Didn't find start bit." << std::endl;
-			return 1;
+			samples.reset(new memorytape(databuffer));
 		}
+		source = samples.get();
+	}
+	cuts likeAKnife(*source, sampleRate);
 
-		int i;
-		BYTE byte;
+	// Tones and cycles per bit are worked out from each leader unless we're
+	// told what to expect.
+	//
+	int hiTone = 0, loTone = 0, oneCycles = 0, zeroCycles = 0;
+	param.getint("hitone", hiTone);
+	param.getint("lotone", loTone);
+	if (hiTone > 0 && loTone > 0)
+	{
+		likeAKnife.m_autoTone = false;
+		likeAKnife.setTones(hiTone, loTone);
+	}
 
-		likeAKnife.m_check = 0;
+	param.getint("cycles1", oneCycles);
+	param.getint("cycles0", zeroCycles);
+	if (oneCycles > 0 && zeroCycles > 0)
+	{
+		likeAKnife.m_autoCycles = false;
+		likeAKnife.setCycles(oneCycles, zeroCycles);
+	}
 
-		// Read header preamble: '****'
-		//
-		for (i = 0; i < 4; ++i)
+	if (remastering)
+	{
+		std::ofstream out(remasterName.c_str(), std::ios_base::out | std::ios_base::binary);
+		if (!out.is_open())
 		{
-			if (!likeAKnife.getByte(byte) || byte != '*')
-			{
-				std::cout << "Failed reading preamble." << std::endl;
-				return 1;
-			}
+			std::cout << "Couldn't write output file: " << remasterName.c_str() << "." << std::endl;
+			return 1;
 		}
 
-		// Now get the filename up to and includeing the 0x0d terminator.
-		// Max size is 13 chars + terminator = 14.
+		std::unique_ptr<freqout> fo(param.ispresent("8bit") ? new freqout8(NULL, out) : newFreqout(NULL, out));
+		fo->createWaveFile();
+
+		int result = remaster(likeAKnife, *fo, param.ispresent("short") ? TIMING_SHORT : TIMING_STANDARD, flacs.get());
+
+		// Whatever made it is still worth having.
 		//
-		i = -1;
-		do
+		fo->finaliseWaveFile();
+		if (result == 0)
 		{
-			if (!likeAKnife.getByte(atomFname[++i]))
-			{
-				std::cout << "Failed reading filename." << std::endl;
-				return 1;
-			}
+			std::cout << "Written WAV '" << remasterName.c_str() << "'." << std::endl;
 		}
-		while(atomFname[i] != 0x0d && i != 13);
-		atomFname[i] = 0x0;
+		return result;
+	}
 
-		// Read header
-		//
-		BYTE* headBytes = (BYTE*)&atomTapeHeader;
-		for (i = 0; i < 8; ++i)
+	// Find the bits of tape worth looking at, 10ms at a time.
+	//
+	if (!param.ispresent("noscan"))
+	{
+		likeAKnife.prescan(sampleRate / 100);
+	}
+
+	tapeblock block;
+	bool unnamed = false;
+
+	do
+	{
+		if (!likeAKnife.readBlock(block, error))
 		{
-			if (!likeAKnife.getByte(headBytes[i]))
+			// No preamble on the very first block means an unnamed file.
+			//
+			if (error == NULL && byteBuffer.empty())
 			{
-				std::cout << "Failed reading header." << std::endl;
-				return 1;
+				unnamed = true;
+				break;
 			}
-		}
 
-		// Courtesy calculations :)
-		//
-		bool firstBlock = (atomTapeHeader.flags & _BV(5)) == 0;
-		bool doLoad = (atomTapeHeader.flags & _BV(6)) != 0;
-		lastBlock = (atomTapeHeader.flags & _BV(7)) == 0;
+			return failed(error ? error : "Failed reading preamble.", flacs.get());
+		}
 
-		if (firstBlock)
+		if (block.isFirst())
 		{
-			memcpy_s(atm.header.filename, 16, atomFname, 14);
-			atm.header.exec = atomTapeHeader.loRunAddress + 256 * atomTapeHeader.hiRunAddress;
-			atm.header.start = atomTapeHeader.loBlockLoadAddress + 256 * atomTapeHeader.hiBlockLoadAddress;
+			memcpy_s(atm.header.filename, 16, block.name, 14);
+			atm.header.exec = block.runAddress();
+			atm.header.start = block.loadAddress();
 			atm.header.length = 0;
 		}
 
-		atm.header.length += atomTapeHeader.bytesInBlockMinus1 + 1;
-
-		size_t writeOffs = byteBuffer.size();
-		byteBuffer.resize(writeOffs + atm.header.length);
-
-		BYTE* data = &byteBuffer.front();
-		data += writeOffs;
+		atm.header.length += block.length();
+		byteBuffer.insert(byteBuffer.end(), block.data, block.data + block.length());
+	}
+	while (!block.isLast());
 
-		// Read data block
+	if (unnamed)
+	{
+		// What we took for a preamble was the address header:
+		// <MSB end address> <LSB end address> <MSB start address> <LSB start address>
+		// followed by the data, end - start bytes of it, and nothing else.
+		// No name, no blocks, no checksum.
 		//
-		for (i = 0; i < atomTapeHeader.bytesInBlockMinus1 + 1; ++i)
+		int endAddr = block.preamble[0] * 256 + block.preamble[1];
+		int startAddr = block.preamble[2] * 256 + block.preamble[3];
+		if (endAddr <= startAddr)
 		{
-			if (!likeAKnife.getByte(data[i]))
-			{
-				std::cout << "Failed reading data block." << std::endl;
-				return 1;
-			}
+			std::cout << "Bad unnamed file addresses " << hex(startAddr, 4) << "-" << hex(endAddr, 4) << "." << std::endl;
+			return 1;
 		}
 
-		// Check some checksum
-		//
-		BYTE sum, expected = likeAKnife.m_check;
-		if (!likeAKnife.getByte(sum))
+		byteBuffer.resize(endAddr - startAddr);
+		for (size_t i = 0; i < byteBuffer.size(); ++i)
 		{
-			std::cout << "Failed reading checksum byte." << std::endl;
-			return 1;
+			if (!likeAKnife.getByte(byteBuffer[i]))
+			{
+				return failed("Failed reading data.", flacs.get());
+			}
 		}
 
-		if (sum != expected)
+		// The tape doesn't know what it's called, so name it after the
+		// output file. There's no run address either, use the load address.
+		//
+		std::string baseName = outName;
+		size_t slashpos = baseName.find_last_of("\\/");
+		if (slashpos != std::string::npos)
 		{
-			std::cout << "SUM" << std::endl;
-			return 1;
+			baseName = baseName.substr(slashpos + 1);
 		}
+		std::string atomName = pc_to_atom(baseName.c_str());
+
+		memset(atm.header.filename, 0, 16);
+		memcpy_s(atm.header.filename, 16, atomName.c_str(), atomName.size());
+		atm.header.start = startAddr;
+		atm.header.exec = startAddr;
+		atm.header.length = (WORD)byteBuffer.size();
+
+		std::cout << "<unnamed>" << "     "
+			<< " " << hex(startAddr, 4)
+			<< " " << hex(endAddr, 4)
+			<< std::endl;
+	}
+	else
+	{
+		std::cout << block.name << "     "
+			<< " " << hex(block.loadAddress(), 4)
+			<< " " << hex(block.runAddress(), 4)
+			<< " " << hex(block.blockNum(), 4)
+			<< " " << hex(block.header.bytesInBlockMinus1, 2)
+			<< std::endl;
 	}
-
-	std::cout << atomFname << "     "
-		<< " " << hex(int(atomTapeHeader.loBlockLoadAddress) + 256 * int(atomTapeHeader.hiBlockLoadAddress), 4)
-		<< " " << hex(int(atomTapeHeader.loRunAddress) + 256 * int(atomTapeHeader.hiRunAddress), 4)
-		<< " " << hex(int(atomTapeHeader.loBlockNum), 4)
-		<< " " << hex(atomTapeHeader.bytesInBlockMinus1, 2)
-		<< std::endl;
 
 	std::cout << ">";
 